@@ -0,0 +1,63 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+Arena* createArena(size_t blocksize) {
+  Arena *arena = (Arena*)malloc(sizeof(Arena));
+  if (!arena) return NULL;
+  arena->head = NULL;
+  arena->blocksize = blocksize ? blocksize : ARENA_BLOCK_SIZE;
+  return arena;
+}
+
+char* arenaAlloc(Arena *arena, size_t len) {
+  ArenaBlock *b = arena->head;
+  if (len > arena->blocksize) {
+    // lines longer than a block get a block of their own, linked behind the
+    // current one so its free space is not lost
+    b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + len);
+    if (!b) return NULL;
+    b->used = b->cap = len;
+    if (arena->head) {
+      b->next = arena->head->next;
+      arena->head->next = b;
+    } else {
+      b->next = NULL;
+      arena->head = b;
+    }
+    return b->data;
+  }
+  if (!b || b->cap - b->used < len) {
+    b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + arena->blocksize);
+    if (!b) return NULL;
+    b->used = 0;
+    b->cap = arena->blocksize;
+    b->next = arena->head;
+    arena->head = b;
+  }
+  char *p = b->data + b->used;
+  b->used += len;
+  return p;
+}
+
+char* arenaGrow(Arena *arena, char *p, size_t len, size_t more) {
+  ArenaBlock *b = arena->head;
+  if (b && p + len == b->data + b->used && b->cap - b->used >= more) {
+    b->used += more;
+    return p;
+  }
+  char *new = arenaAlloc(arena, len + more);
+  if (new && len) memcpy(new, p, len);
+  return new;
+}
+
+void arenaFree(Arena *arena) {
+  if (!arena) return;
+  ArenaBlock *b = arena->head;
+  while (b) {
+    ArenaBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+  free(arena);
+}
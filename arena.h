@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+/*
+  Bump allocator for row text. Memory is handed out from large blocks and
+  only released all at once with arenaFree, so loading a file costs one
+  malloc per block instead of one per line.
+ */
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t used;
+  size_t cap;
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *head;
+  size_t blocksize;
+} Arena;
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+Arena* createArena(size_t blocksize);
+char* arenaAlloc(Arena *arena, size_t len);
+/*
+  Extend the allocation p of len bytes by more bytes. It grows in place
+  when it is the last thing allocated, otherwise it is copied.
+ */
+char* arenaGrow(Arena *arena, char *p, size_t len, size_t more);
+void arenaFree(Arena *arena);
+#endif
@@ -0,0 +1,166 @@
+/*
+ * bigfile: open, search, edit and save a file over 4 GB that holds one
+ * line over 2 GB, in the headless editor, checking that nothing is lost
+ * to 32 bit sizes or offsets on the way.
+ *
+ *   make bench
+ *   ./bench/bigfile [file]
+ *
+ * The file, /tmp/kilo-big.txt by default, is written unless it already
+ * has the expected size, and is rewritten by the save at the end.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "kilo.h"
+
+#define ROWS 24
+#define COLS 80
+#define HEAD_BYTES (1L << 30)
+#define LONG_BYTES ((2L << 30) + (64L << 20)) // past INT_MAX
+#define TAIL_BYTES (1L << 30)
+#define LONG_END "KILO-LONG-END"
+#define BIG_END "KILO-BIG-END"
+
+static VTerm *term;
+static int failed;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+  long headlines; // lines before the long line
+  long lines;
+  long longend; // offset of the newline ending the long line
+  long size;
+} layout;
+
+/* write lines until at least bytes are written, returns the line count */
+static long writeLines(FILE *fp, long bytes, long *written) {
+  long lines = 0;
+  for (long end = *written + bytes; *written < end; lines++)
+    *written += fprintf(fp, "line %ld of the big file, nothing to see here\n", lines);
+  return lines;
+}
+
+/*
+  Lay the file out into fp: short lines, one long line, short lines and a
+  last line to find. With fp on /dev/null and data 0 this only measures
+  the layout, without writing the long line.
+ */
+static layout writeBig(FILE *fp, int data) {
+  static char chunk[1 << 20];
+  layout l = {0};
+  memset(chunk, 'x', sizeof(chunk));
+  l.headlines = writeLines(fp, HEAD_BYTES, &l.size);
+  for (long n = 0; n < LONG_BYTES; n += sizeof(chunk))
+    l.size += data ? (long)fwrite(chunk, 1, sizeof(chunk), fp) : (long)sizeof(chunk);
+  l.size += fprintf(fp, "%s\n", LONG_END);
+  l.longend = l.size - 1;
+  l.lines = l.headlines + 1 + writeLines(fp, TAIL_BYTES, &l.size) + 1;
+  l.size += fprintf(fp, "%s\n", BIG_END);
+  return l;
+}
+
+/* print the result, and the screen it was read from when it failed */
+static void check(int ok, const char *what) {
+  printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+  if (ok)
+    return;
+  failed = 1;
+  char line[COLS * 4 + 1];
+  for (int y = 0; y < ROWS; y++) {
+    vtermLine(term, y, line, sizeof(line));
+    printf("  | %s\n", line);
+  }
+}
+
+static double step(const char *keys) {
+  double t = now();
+  editorStep(keys, strlen(keys));
+  return now() - t;
+}
+
+static int screenHas(const char *text) {
+  char line[COLS * 4 + 1];
+  for (int y = 0; y < ROWS; y++) {
+    vtermLine(term, y, line, sizeof(line));
+    if (strstr(line, text))
+      return 1;
+  }
+  return 0;
+}
+
+/* row and row count from the "cy/numrows" right of the status bar */
+static int statusPos(long *row, long *rows) {
+  char line[COLS * 4 + 1];
+  vtermLine(term, ROWS - 2, line, sizeof(line));
+  char *p = strrchr(line, ' ');
+  return p && sscanf(p + 1, "%ld/%ld", row, rows) == 2;
+}
+
+static int fileHas(int fd, long off, const char *text) {
+  char buf[64];
+  size_t len = strlen(text);
+  return pread(fd, buf, len, off) == (ssize_t)len && memcmp(buf, text, len) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  char *filename = argc > 1 ? argv[1] : "/tmp/kilo-big.txt";
+  FILE *fp = fopen("/dev/null", "w");
+  if (!fp) { perror("/dev/null"); exit(1); }
+  layout l = writeBig(fp, 0);
+  fclose(fp);
+  struct stat st;
+  if (stat(filename, &st) == -1 || st.st_size != l.size) {
+    fprintf(stderr, "writing %s\n", filename);
+    double t = now();
+    fp = fopen(filename, "w");
+    if (!fp) { perror(filename); exit(1); }
+    writeBig(fp, 1);
+    if (fclose(fp) == EOF) { perror(filename); exit(1); }
+    printf("%-40s %8.3f s\n", "write", now() - t);
+  }
+
+  term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); exit(1); }
+  editorHeadless(term);
+  double t = now();
+  editorOpen(filename);
+  editorStep(NULL, 0);
+  printf("%-40s %8.3f s\n", "open", now() - t);
+  long row, rows;
+  check(statusPos(&row, &rows) && row == 1 && rows == l.lines, "line count");
+
+  t = step("\x06" LONG_END "\r\x05");
+  printf("%-40s %8.3f s\n", "search to the end of the long line", t);
+  check(statusPos(&row, &rows) && row == l.headlines + 1, "cursor on the long line");
+  check(screenHas(LONG_END), "end of the long line drawn");
+
+  t = step("\x06" BIG_END "\r\x05!");
+  printf("%-40s %8.3f s\n", "search to the last line and type", t);
+  check(statusPos(&row, &rows) && row == l.lines, "cursor on the last line");
+  check(screenHas(BIG_END "!"), "edit drawn");
+
+  t = now();
+  editorStep("\x13", 1);
+  editorSaveCheck(1);
+  printf("%-40s %8.3f s\n", "save", now() - t);
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) { perror(filename); exit(1); }
+  check(fstat(fd, &st) == 0 && st.st_size == l.size + 1, "saved size");
+  check(fileHas(fd, l.longend - strlen(LONG_END), LONG_END "\n"), "long line saved");
+  check(fileHas(fd, l.size - strlen(BIG_END) - 1, BIG_END "!\n"), "edit saved");
+  close(fd);
+  destroyVTerm(term);
+  return failed;
+}
@@ -0,0 +1,140 @@
+/*
+ * followbench: keep up with a file being appended to in follow mode.
+ *
+ *   make bench
+ *   ./bench/followbench [MB/s] [seconds]
+ *
+ * A child process appends 100 byte lines to /tmp/kilo-follow.txt at the
+ * given rate, default 50 MB/s for 5 seconds, while the headless editor
+ * follows it and draws a frame every 33 ms like the tty loop does. Prints
+ * the frame times, how far behind the writer the rows got, and checks
+ * that every line arrived and the cursor stayed on the last one.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "kilo.h"
+
+#define ROWS 24
+#define COLS 80
+#define LINE 100
+#define FRAME 0.033
+#define FILENAME "/tmp/kilo-follow.txt"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void sleepUntil(double t) {
+  double left = t - now();
+  if (left > 0) {
+    struct timespec ts = {(time_t)left, (long)((left - (time_t)left) * 1e9)};
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* append numbered lines at rate bytes a second, a millisecond's worth at a time */
+static void writer(double rate, double secs) {
+  int fd = open(FILENAME, O_WRONLY | O_APPEND);
+  if (fd == -1) { perror(FILENAME); exit(1); }
+  long perms = rate / 1000 / LINE + 1;
+  char *buf = malloc(perms * LINE);
+  long line = 0;
+  double start = now();
+  for (long ms = 0; ms < secs * 1000; ms++) {
+    for (long i = 0; i < perms; i++, line++) {
+      char *p = buf + i * LINE;
+      int n = snprintf(p, LINE, "%010ld written at %.6f ", line, now() - start);
+      memset(p + n, '.', LINE - 1 - n);
+      p[LINE - 1] = '\n';
+    }
+    if (write(fd, buf, perms * LINE) != perms * LINE) { perror("write"); exit(1); }
+    sleepUntil(start + (ms + 1) / 1000.0);
+  }
+  close(fd);
+  _exit(0);
+}
+
+/* lines in the status bar, "name - N lines ..." */
+static long statusLines(VTerm *term) {
+  char line[COLS * 4 + 1];
+  vtermLine(term, ROWS - 2, line, sizeof(line));
+  char *p = strstr(line, " - ");
+  return p ? atol(p + 3) : -1;
+}
+
+int main(int argc, char *argv[]) {
+  double rate = (argc > 1 ? atof(argv[1]) : 50) * 1e6;
+  double secs = argc > 2 ? atof(argv[2]) : 5;
+  int fd = open(FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) { perror(FILENAME); return 1; }
+  close(fd);
+
+  VTerm *term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); return 1; }
+  editorHeadless(term);
+  editorOpen(FILENAME);
+  editorSetFollow(1);
+
+  pid_t pid = fork();
+  if (pid == -1) { perror("fork"); return 1; }
+  if (pid == 0)
+    writer(rate, secs);
+
+  int cap = (secs + 2) / FRAME + 16, n = 0;
+  double *times = malloc(sizeof(double) * cap);
+  long maxlag = 0;
+  int done = 0;
+  double next = now();
+  while (!done) {
+    // one more frame after the writer is gone picks up its last lines
+    done = waitpid(pid, NULL, WNOHANG) == pid;
+    double t = now();
+    editorStep(NULL, 0);
+    if (n < cap)
+      times[n++] = now() - t;
+    struct stat st;
+    stat(FILENAME, &st);
+    long lag = st.st_size - statusLines(term) * LINE;
+    if (lag > maxlag)
+      maxlag = lag;
+    next += FRAME;
+    sleepUntil(next);
+  }
+
+  struct stat st;
+  stat(FILENAME, &st);
+  long lines = st.st_size / LINE;
+  qsort(times, n, sizeof(double), cmpDouble);
+  printf("%.0f MB/s for %.0f s, %ld lines, %d frames\n", rate / 1e6, secs, lines, n);
+  printf("frame ms   p50 %.3f  p99 %.3f  max %.3f\n", times[n / 2] * 1e3,
+         times[n * 99 / 100] * 1e3, times[n - 1] * 1e3);
+  printf("max lag    %.2f MB\n", maxlag / 1e6);
+
+  char last[32], line[COLS * 4 + 1];
+  snprintf(last, sizeof(last), "%010ld ", lines - 1);
+  int shown = 0;
+  for (int y = 0; y < ROWS - 2; y++) {
+    vtermLine(term, y, line, sizeof(line));
+    shown |= strncmp(line, last, strlen(last)) == 0;
+  }
+  int ok = statusLines(term) == lines && shown;
+  printf("all lines, last on screen: %s\n", ok ? "ok" : "FAILED");
+  free(times);
+  destroyVTerm(term);
+  return !ok;
+}
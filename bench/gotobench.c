@@ -0,0 +1,157 @@
+/*
+ * gotobench: jump straight to a line deep into a big file and page from
+ * there, first with the file's line index built by reading it through,
+ * then with the index saved next to it by the first open.
+ *
+ *   make bench
+ *   ./bench/gotobench [size] [line]
+ *
+ * Size is bytes with an optional K, M or G suffix, default 2G, written to
+ * /tmp/kilo-goto.txt in numbered lines of 48 bytes unless it already has
+ * that size. Line defaults to 40000000, or 90% of the file if it has
+ * fewer lines. Each open runs in a child process, since the editor is
+ * one per process, and checks the rows it lands on.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "kilo.h"
+
+#define ROWS 24
+#define COLS 80
+#define LINES (ROWS - 2)
+#define FILENAME "/tmp/kilo-goto.txt"
+#define INDEXNAME "/tmp/.kilo-goto.txt.kidx"
+#define LINE 48
+#define PAGES 1000
+
+static VTerm *term;
+static int failed;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static long parseSize(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+  if (*end == 'K' || *end == 'k') n <<= 10;
+  else if (*end == 'M' || *end == 'm') n <<= 20;
+  else if (*end == 'G' || *end == 'g') n <<= 30;
+  return n;
+}
+
+static void writeFile(long lines) {
+  FILE *fp = fopen(FILENAME, "w");
+  if (!fp) { perror(FILENAME); exit(1); }
+  char line[LINE + 1];
+  for (long i = 0; i < lines; i++) {
+    int n = snprintf(line, sizeof(line), "%012ld go to this line ", i + 1);
+    memset(line + n, '.', LINE - 1 - n);
+    line[LINE - 1] = '\n';
+    fwrite(line, 1, LINE, fp);
+  }
+  if (fclose(fp) == EOF) { perror(FILENAME); exit(1); }
+}
+
+/* the screen shows the file from line first, numbered from 1 */
+static void check(const char *what, long first, long lines) {
+  char want[32], got[COLS * 4 + 1];
+  for (int y = 0; y < LINES; y++) {
+    if (first + y > lines)
+      strcpy(want, "~");
+    else
+      snprintf(want, sizeof(want), "%012ld ", first + y);
+    vtermLine(term, y, got, sizeof(got));
+    if (strncmp(got, want, strlen(want)) != 0) {
+      if (!failed)
+        printf("  %s: screen line %d is \"%.20s\", want \"%s\"\n", what, y, got, want);
+      failed = 1;
+      return;
+    }
+  }
+}
+
+/* first line on screen, from the line number it starts with */
+static long topLine() {
+  char got[COLS * 4 + 1];
+  vtermLine(term, 0, got, sizeof(got));
+  return atol(got);
+}
+
+static double step(const char *keys) {
+  double t = now();
+  editorStep(keys, strlen(keys));
+  return now() - t;
+}
+
+/* one open in a child process: go to the line, a percentage, and page */
+static void run(const char *what, long lines, long target) {
+  term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); exit(1); }
+  editorHeadless(term);
+  double t = now();
+  editorOpen(FILENAME);
+  editorStep(NULL, 0);
+  printf("%s\n  %-24s %10.3f ms\n", what, "open", (now() - t) * 1e3);
+
+  char keys[64];
+  snprintf(keys, sizeof(keys), "\x0e%ld\r", target);
+  printf("  %-24s %10.3f ms\n", "go to line", step(keys) * 1e3);
+  check("go to line", target - LINES / 2, lines);
+  long half = (lines - 1) * 50 / 100 + 1;
+  printf("  %-24s %10.3f ms\n", "go to 50%", step("\x0e" "50%\r") * 1e3);
+  check("go to 50%", half - LINES / 2, lines);
+
+  double times[PAGES];
+  long top = topLine();
+  for (int i = 0; i < PAGES; i++)
+    times[i] = step(i % 2 ? "\x1b[5~" : "\x1b[6~\x1b[6~");
+  check("paging", top + PAGES / 2 * LINES, lines);
+  qsort(times, PAGES, sizeof(double), cmpDouble);
+  printf("  %-24s %10.3f ms p50, %.3f ms p99\n", "page up and down",
+         times[PAGES / 2] * 1e3, times[PAGES * 99 / 100] * 1e3);
+  destroyVTerm(term);
+  exit(failed);
+}
+
+int main(int argc, char *argv[]) {
+  long size = parseSize(argc > 1 ? argv[1] : "2G");
+  long lines = size / LINE;
+  long target = argc > 2 ? atol(argv[2]) : 40000000;
+  if (target > lines)
+    target = lines * 9 / 10;
+  struct stat st;
+  if (stat(FILENAME, &st) == -1 || st.st_size != lines * LINE) {
+    fprintf(stderr, "writing %s\n", FILENAME);
+    writeFile(lines);
+  }
+  // the first open reads the file through and saves its index
+  unlink(INDEXNAME);
+  const char *what[2] = {"without a saved index", "with the saved index"};
+  for (int i = 0; i < 2; i++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) { perror("fork"); return 1; }
+    if (pid == 0)
+      run(what[i], lines, target);
+    int status;
+    waitpid(pid, &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  printf("screens show the lines jumped to: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,137 @@
+/*
+ * loadbench: time editorOpen on a large file.
+ *
+ * Runs the old loader (realloc of the row array per line, malloc for chars
+ * and render of every row) next to the current editorOpen so the two can
+ * be compared on the same file.
+ *
+ *   make bench
+ *   ./bench/loadbench [file | lines]
+ *
+ * A file is only read. Otherwise a synthetic log of `lines` lines
+ * (default 2M) is written to /tmp/kilo-loadbench.txt first.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+void editorOpen(char *filename);
+
+#define KILO_TAB_STOP 8
+
+typedef struct {
+  int size;
+  int rsize;
+  char *chars;
+  char *render;
+} legacyRow;
+
+static legacyRow *lrows;
+static int lnumrows;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the loader as it was before rows were bulk allocated */
+static void legacyAppendRow(char *s, size_t len) {
+  lrows = realloc(lrows, sizeof(legacyRow) * (lnumrows + 1));
+  legacyRow *row = &lrows[lnumrows];
+  row->size = len;
+  row->chars = malloc(len + 1);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+  int tabs = 0;
+  for (size_t i = 0; i < len; i++)
+    if (s[i] == '\t') tabs++;
+  row->render = malloc(len + tabs * (KILO_TAB_STOP - 1) + 1);
+  int idx = 0;
+  for (size_t j = 0; j < len; j++) {
+    if (s[j] == '\t') {
+      row->render[idx++] = ' ';
+      while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
+    } else {
+      row->render[idx++] = s[j];
+    }
+  }
+  row->render[idx] = '\0';
+  row->rsize = idx;
+  lnumrows++;
+}
+
+static void legacyOpen(char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) { perror("fopen"); exit(1); }
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    while (linelen > 0 &&
+           (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+      linelen--;
+    legacyAppendRow(line, linelen);
+  }
+  free(line);
+  fclose(fp);
+}
+
+static void writeSample(const char *filename, long lines) {
+  FILE *fp = fopen(filename, "w");
+  if (!fp) { perror("fopen"); exit(1); }
+  for (long i = 0; i < lines; i++) {
+    fprintf(fp, "2024-01-01T00:00:%02ld.%06ld\tINFO\trequest %ld served in %ld ms",
+            i % 60, i % 1000000, i, (i * 7919) % 997);
+    // every tenth line is long to exercise bigger allocations
+    if (i % 10 == 0)
+      fprintf(fp, " payload=%0*ld", (int)(i % 200), i);
+    fputc('\n', fp);
+  }
+  fclose(fp);
+}
+
+/* read the file once so both loaders start from a warm page cache */
+static long warmCache(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) { perror("fopen"); exit(1); }
+  char buf[1 << 16];
+  long total = 0;
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) total += n;
+  fclose(fp);
+  return total;
+}
+
+int main(int argc, char *argv[]) {
+  char *filename = "/tmp/kilo-loadbench.txt";
+  long lines = 2000000;
+  char *end = NULL;
+  if (argc >= 2)
+    lines = strtol(argv[1], &end, 10);
+  if (end != NULL && (end == argv[1] || *end != '\0')) {
+    // not a number, so a file to load as it is
+    filename = argv[1];
+  } else {
+    printf("writing %ld lines to %s\n", lines, filename);
+    writeSample(filename, lines);
+  }
+  long bytes = warmCache(filename);
+
+  double t0 = now();
+  legacyOpen(filename);
+  double legacy = now() - t0;
+
+  t0 = now();
+  editorOpen(filename);
+  double current = now() - t0;
+
+  printf("%d lines, %.1f MB\n", lnumrows, bytes / 1e6);
+  printf("legacy loader: %8.1f ms\n", legacy * 1e3);
+  printf("editorOpen:    %8.1f ms (%.1fx)\n", current * 1e3, legacy / current);
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * reloadbench: how long the editor takes to pick up a small change that
+ * another program made to a large open file.
+ *
+ *   make bench
+ *   ./bench/reloadbench [size]
+ *
+ * Size is bytes with an optional K, M or G suffix, default 2G. A synthetic
+ * log of that size is written to /tmp/kilo-reload.txt, opened in the
+ * headless editor, and then changed behind its back: a word overwritten
+ * in place, a line inserted in the middle by writing a new file over it,
+ * and a line appended. Each change is timed from the step that notices it
+ * to the frame being drawn, and checked against the status bar. The file
+ * is written again by the next run, since the changes leave it longer.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "kilo.h"
+
+#define ROWS 24
+#define COLS 80
+#define FILENAME "/tmp/kilo-reload.txt"
+#define TMPNAME "/tmp/kilo-reload.tmp"
+#define LINE 64
+
+static VTerm *term;
+static int failed;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long parseSize(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+  if (*end == 'K' || *end == 'k') n <<= 10;
+  else if (*end == 'M' || *end == 'm') n <<= 20;
+  else if (*end == 'G' || *end == 'g') n <<= 30;
+  return n;
+}
+
+/* write lines lines of LINE bytes to fp, with extra inserted before line at */
+static void writeLines(FILE *fp, long lines, long at, const char *extra) {
+  char line[LINE + 1];
+  for (long i = 0; i < lines; i++) {
+    if (i == at)
+      fputs(extra, fp);
+    int n = snprintf(line, sizeof(line), "%012ld INFO request served in %ld ms ", i, i % 997);
+    memset(line + n, '.', LINE - 1 - n);
+    line[LINE - 1] = '\n';
+    fwrite(line, 1, LINE, fp);
+  }
+}
+
+static void writeFile(const char *filename, long lines, long at, const char *extra) {
+  FILE *fp = fopen(filename, "w");
+  if (!fp) { perror(filename); exit(1); }
+  writeLines(fp, lines, at, extra);
+  if (fclose(fp) == EOF) { perror(filename); exit(1); }
+}
+
+/* lines in the status bar, "name - N lines ..." */
+static long statusLines() {
+  char line[COLS * 4 + 1];
+  vtermLine(term, ROWS - 2, line, sizeof(line));
+  char *p = strstr(line, " - ");
+  return p ? atol(p + 3) : -1;
+}
+
+static int messageHas(const char *text) {
+  char line[COLS * 4 + 1];
+  vtermLine(term, ROWS - 1, line, sizeof(line));
+  return strstr(line, text) != NULL;
+}
+
+/* step until the change is noticed, returns the time of that step */
+static double reload(const char *what, long lines) {
+  double t = 0;
+  for (int i = 0; i < 100 && !messageHas("reloaded"); i++) {
+    double start = now();
+    editorStep(NULL, 0);
+    t = now() - start;
+  }
+  char line[COLS * 4 + 1];
+  vtermLine(term, ROWS - 1, line, sizeof(line));
+  char *p = strstr(line, "reloaded ");
+  long parsed = p ? atol(p + 9) : -1;
+  int ok = p && statusLines() == lines;
+  printf("%-30s %10.3f ms %8ld lines parsed  %s\n", what, t * 1e3, parsed, ok ? "ok" : "FAILED");
+  if (!ok) {
+    printf("  | %s\n", line);
+    failed = 1;
+  }
+  editorSetStatusMessage("");
+  editorStep(NULL, 0);
+  return t;
+}
+
+int main(int argc, char *argv[]) {
+  long size = parseSize(argc > 1 ? argv[1] : "2G");
+  long lines = size / LINE;
+  struct stat st;
+  if (stat(FILENAME, &st) == -1 || st.st_size != lines * LINE) {
+    fprintf(stderr, "writing %s\n", FILENAME);
+    writeFile(FILENAME, lines, -1, NULL);
+  }
+
+  term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); return 1; }
+  editorHeadless(term);
+  double t = now();
+  editorOpen(FILENAME);
+  editorStep(NULL, 0);
+  printf("%-30s %10.3f ms\n", "open", (now() - t) * 1e3);
+  // the rows on screen and a few pages below them are materialized
+  editorStep("\x1b[6~\x1b[6~\x1b[6~", 12);
+
+  // a word in the middle overwritten in place
+  int fd = open(FILENAME, O_WRONLY);
+  if (fd == -1 || pwrite(fd, "WARN", 4, lines / 2 * LINE + 13) != 4) { perror(FILENAME); return 1; }
+  close(fd);
+  reload("word overwritten in place", lines);
+
+  // a line inserted in the middle, the file replaced like editors save
+  writeFile(TMPNAME, lines, lines / 2, "a line that wasn't there before\n");
+  if (rename(TMPNAME, FILENAME) == -1) { perror(TMPNAME); return 1; }
+  reload("line inserted, file replaced", lines + 1);
+
+  // a line appended
+  FILE *fp = fopen(FILENAME, "a");
+  if (!fp) { perror(FILENAME); return 1; }
+  fputs("one more line at the end\n", fp);
+  fclose(fp);
+  reload("line appended", lines + 2);
+  destroyVTerm(term);
+  return failed;
+}
@@ -0,0 +1,220 @@
+/*
+ * replaybench: per operation latency of the headless editor, from the key
+ * arriving to the frame being drawn into an in-memory 24x80 terminal.
+ *
+ *   make bench
+ *   ./bench/replaybench [-s script] [size ...]
+ *
+ * Sizes are bytes with an optional K, M or G suffix, default 1K 1M 100M 1G.
+ * A synthetic log of each size is written to /tmp/kilo-replay-<size>.txt
+ * unless it already exists. Every size is run in fresh processes, since
+ * the editor keeps one file per process: a few that only time editorOpen,
+ * then one that replays scrolling, paging, typing and saving in turn, and
+ * the lines of the -s replay script as one more operation.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "kilo.h"
+
+#define LOAD_RUNS 5
+#define ROWS 24
+#define COLS 80
+
+enum { OP_LOAD, OP_SCROLL, OP_PAGE, OP_TYPE, OP_SAVE, OP_SCRIPT, NOPS };
+static const char *opnames[NOPS] = {"load", "scroll", "page", "type", "save", "script"};
+
+/* one timing, sent from the child that measured it */
+typedef struct {
+  int op;
+  double secs;
+} sample;
+
+static int out; // pipe to the parent
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(int op, double secs) {
+  sample s = {op, secs};
+  if (write(out, &s, sizeof(s)) != sizeof(s)) {
+    perror("write");
+    exit(1);
+  }
+}
+
+static void step(int op, const char *keys) {
+  double t = now();
+  editorStep(keys, strlen(keys));
+  report(op, now() - t);
+}
+
+static void writeSample(const char *filename, long bytes) {
+  FILE *fp = fopen(filename, "w");
+  if (!fp) { perror("fopen"); exit(1); }
+  long written = 0;
+  for (long i = 0; written < bytes; i++) {
+    written += fprintf(fp, "2024-01-01T00:00:%02ld.%06ld\tINFO\trequest %ld served in %ld ms",
+                       i % 60, i % 1000000, i, (i * 7919) % 997);
+    if (i % 10 == 0)
+      written += fprintf(fp, " payload=%0*ld", (int)(i % 200), i);
+    fputc('\n', fp);
+    written++;
+  }
+  fclose(fp);
+}
+
+static void openTimed(char *filename) {
+  VTerm *term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); exit(1); }
+  editorHeadless(term);
+  double t = now();
+  editorOpen(filename);
+  editorStep(NULL, 0);
+  report(OP_LOAD, now() - t);
+}
+
+static void replayScript(const char *script) {
+  FILE *fp = fopen(script, "r");
+  if (!fp) { perror(script); exit(1); }
+  char *line = NULL;
+  size_t linecap = 0;
+  while (getline(&line, &linecap, fp) != -1) {
+    char *keys = malloc(linecap);
+    int count;
+    int len = editorParseScriptLine(line, keys, &count);
+    for (int i = 0; len >= 0 && i < count; i++) {
+      double t = now();
+      int running = editorStep(keys, len);
+      report(OP_SCRIPT, now() - t);
+      if (!running)
+        break;
+    }
+    free(keys);
+  }
+  free(line);
+  fclose(fp);
+}
+
+static void runOps(char *filename, long bytes, const char *script) {
+  openTimed(filename);
+  for (int i = 0; i < 2000; i++)
+    step(OP_SCROLL, "\x1b[B");
+  for (int i = 0; i < 500; i++)
+    step(OP_PAGE, i % 5 == 4 ? "\x1b[5~" : "\x1b[6~");
+  // type at the top of the file, which a large file maps in lazily
+  editorStep("\x1b[5~\x1b[5~\x1b[H", 12);
+  const char *words = "the quick brown fox jumps over the lazy dog ";
+  for (int i = 0; i < 2000; i++) {
+    char key[2] = {i % 60 == 59 ? '\r' : words[i % 44], '\0'};
+    step(OP_TYPE, key);
+  }
+  int saves = bytes >= (256L << 20) ? 3 : 10;
+  for (int i = 0; i < saves; i++) {
+    double t = now();
+    editorStep("\x13", 1);
+    editorSaveCheck(1);
+    report(OP_SAVE, now() - t);
+  }
+  if (script)
+    replayScript(script);
+}
+
+static long parseSize(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+  if (*end == 'K' || *end == 'k') n <<= 10;
+  else if (*end == 'M' || *end == 'm') n <<= 20;
+  else if (*end == 'G' || *end == 'g') n <<= 30;
+  return n;
+}
+
+static void runSize(const char *size, const char *script) {
+  long bytes = parseSize(size);
+  char filename[256];
+  snprintf(filename, sizeof(filename), "/tmp/kilo-replay-%s.txt", size);
+  struct stat st;
+  if (stat(filename, &st) == -1 || st.st_size < bytes) {
+    fprintf(stderr, "writing %s\n", filename);
+    writeSample(filename, bytes);
+  }
+
+  double *times[NOPS] = {NULL};
+  int n[NOPS] = {0}, cap[NOPS] = {0};
+  // one run at a time so the runs don't compete for the CPU and disk
+  for (int run = 0; run <= LOAD_RUNS; run++) {
+    int fds[2];
+    if (pipe(fds) == -1) { perror("pipe"); exit(1); }
+    pid_t pid = fork();
+    if (pid == -1) { perror("fork"); exit(1); }
+    if (pid == 0) {
+      close(fds[0]);
+      out = fds[1];
+      // the last run carries on with everything but the load
+      if (run < LOAD_RUNS)
+        openTimed(filename);
+      else
+        runOps(filename, bytes, script);
+      _exit(0);
+    }
+    close(fds[1]);
+    sample s;
+    while (read(fds[0], &s, sizeof(s)) == sizeof(s)) {
+      if (n[s.op] == cap[s.op]) {
+        cap[s.op] = cap[s.op] ? cap[s.op] * 2 : 256;
+        times[s.op] = realloc(times[s.op], sizeof(double) * cap[s.op]);
+      }
+      times[s.op][n[s.op]++] = s.secs;
+    }
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      fprintf(stderr, "%s: run %d failed\n", size, run);
+  }
+
+  for (int op = 0; op < NOPS; op++) {
+    if (n[op] == 0)
+      continue;
+    qsort(times[op], n[op], sizeof(double), cmpDouble);
+    double *t = times[op];
+    printf("%-6s %-7s %6d %10.3f %10.3f %10.3f %10.3f\n", size, opnames[op],
+           n[op], t[n[op] / 2] * 1e3, t[n[op] * 9 / 10] * 1e3,
+           t[n[op] * 99 / 100] * 1e3, t[n[op] - 1] * 1e3);
+    free(times[op]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *script = NULL;
+  int first = 1;
+  if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
+    script = argv[2];
+    first = 3;
+  }
+  static const char *defaults[] = {"1K", "1M", "100M", "1G"};
+  const char **sizes = first < argc ? (const char **)&argv[first] : defaults;
+  int nsizes = first < argc ? argc - first : 4;
+
+  printf("%-6s %-7s %6s %10s %10s %10s %10s\n", "size", "op", "n",
+         "p50 ms", "p90 ms", "p99 ms", "max ms");
+  fflush(stdout);
+  for (int i = 0; i < nsizes; i++) {
+    runSize(sizes[i], script);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * rowmem: memory per row of a loaded file once every row is rendered.
+ *
+ * Rows without tabs or control chars share chars as their render, the
+ * "copied" column is what they would take if each had its own copy.
+ *
+ *   make bench
+ *   ./bench/rowmem file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+struct erow;
+void editorOpen(char *filename);
+struct erow *editorRow(ssize_t at);
+void editorUpdateRow(struct erow *row);
+void editorRowMemory(long *rows, long *text, long *render, long *elided);
+
+static ssize_t countLines(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) { perror("fopen"); exit(1); }
+  ssize_t lines = 0;
+  int c, last = '\n';
+  while ((c = getc(fp)) != EOF) {
+    if (c == '\n') lines++;
+    last = c;
+  }
+  fclose(fp);
+  return lines + (last != '\n');
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file\n", argv[0]);
+    return 1;
+  }
+  ssize_t lines = countLines(argv[1]);
+  editorOpen(argv[1]);
+  for (ssize_t j = 0; j < lines; j++)
+    editorUpdateRow(editorRow(j));
+
+  long rows, text, render, elided;
+  editorRowMemory(&rows, &text, &render, &elided);
+  long shared = rows + text + render;
+  long copied = shared + elided;
+  printf("%zd lines\n", lines);
+  printf("           %12s %12s\n", "copied", "shared");
+  printf("rows       %12ld %12ld\n", rows, rows);
+  printf("text       %12ld %12ld\n", text, text);
+  printf("render     %12ld %12ld\n", render + elided, render);
+  printf("total      %12ld %12ld\n", copied, shared);
+  printf("per row    %12.1f %12.1f\n", (double)copied / lines, (double)shared / lines);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * searchbench: throughput of the whole file search behind Ctrl-F match
+ * counting and the Ctrl-G matching lines panel.
+ *
+ *   make bench
+ *   ./bench/searchbench [file] [lines]
+ *
+ * Without a file a synthetic log of `lines` lines (default 2M) is written
+ * to /tmp/kilo-searchbench.txt first. Files of 64 MB and more are opened
+ * mapped, so this measures the raw file byte path; smaller files measure
+ * the row path. Each query is timed with 1 worker and then with one per
+ * CPU.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+void editorOpen(char *filename);
+void editorSetSearchThreads(int n);
+long editorSearchRows(const char *query, size_t qlen, ssize_t **rows, ssize_t *nrows,
+                      int cancelable);
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void writeSample(const char *filename, long lines) {
+  FILE *fp = fopen(filename, "w");
+  if (!fp) { perror("fopen"); exit(1); }
+  for (long i = 0; i < lines; i++)
+    fprintf(fp, "2024-01-01T00:00:%02ld.%06ld\tINFO\trequest %ld served in %ld ms\n",
+            i % 60, i % 1000000, i, (i * 7919) % 997);
+  fclose(fp);
+}
+
+static void run(const char *query, int threads, double mb) {
+  editorSetSearchThreads(threads);
+  // first run warms caches and materializes nothing, time the second
+  editorSearchRows(query, strlen(query), NULL, NULL, 0);
+  double t0 = now();
+  long count = editorSearchRows(query, strlen(query), NULL, NULL, 0);
+  double t = now() - t0;
+  printf("%-24s %2d threads %10ld matches %8.1f ms %8.1f MB/s\n",
+         query, threads, count, t * 1e3, mb / t);
+}
+
+int main(int argc, char *argv[]) {
+  char *filename = "/tmp/kilo-searchbench.txt";
+  long lines = 2000000;
+  if (argc >= 2) filename = argv[1];
+  if (argc >= 3) lines = atol(argv[2]);
+  if (argc < 2 || argc >= 3) {
+    printf("writing %ld lines to %s\n", lines, filename);
+    writeSample(filename, lines);
+  }
+  struct stat st;
+  if (stat(filename, &st) == -1) { perror("stat"); exit(1); }
+  double mb = st.st_size / 1e6;
+  editorOpen(filename);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *queries[] = {"served in 42 ms", "request 1999999", "INFO"};
+  printf("%.1f MB, %ld CPUs\n", mb, cpus);
+  for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+    run(queries[i], 1, mb);
+    if (cpus > 1)
+      run(queries[i], cpus, mb);
+  }
+  return 0;
+}
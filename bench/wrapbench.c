@@ -0,0 +1,199 @@
+/*
+ * wrapbench: page through a file of long lines with soft wrapping on.
+ *
+ *   make bench
+ *   ./bench/wrapbench [size] [pages]
+ *
+ * Size is bytes with an optional K, M or G suffix, default 128M, which is
+ * big enough to be mapped and materialized lazily. A log with lines of
+ * every length up to a few screens wide is written to /tmp/kilo-wrap.txt
+ * and opened in the headless editor with ^W. It pages down from the top,
+ * jumps to a line near the end with a search and pages up from there,
+ * comparing every screen with the wrapped lines it should show and
+ * printing the frame times of each part.
+ */
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "kilo.h"
+
+#define ROWS 24
+#define COLS 80
+#define LINES (ROWS - 2)
+#define FILENAME "/tmp/kilo-wrap.txt"
+#define MARKER "a line to jump to"
+
+static VTerm *term;
+static char *text; // the file
+static long *starts; // offset of every line
+static long *before; // screen lines before every line
+static long nlines;
+static int failed;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static long parseSize(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+  if (*end == 'K' || *end == 'k') n <<= 10;
+  else if (*end == 'M' || *end == 'm') n <<= 20;
+  else if (*end == 'G' || *end == 'g') n <<= 30;
+  return n;
+}
+
+/* lines of 0 to 4 screens and a bit, with one marker line near the end */
+static long makeText(long size) {
+  text = malloc(size + 4096);
+  long len = 0, i = 0;
+  int marked = 0;
+  srand(1);
+  while (len < size) {
+    int n = snprintf(text + len, 64, "%010ld ", i);
+    int width = rand() % 8 == 0 ? COLS * (rand() % 3) : rand() % (COLS * 4 + 2);
+    if (len > size - size / 16 && !marked++)
+      n += snprintf(text + len + n, 64, MARKER " ");
+    for (; n < width; n++)
+      text[len + n] = 'a' + (i + n) % 26;
+    text[len + n++] = '\n';
+    len += n;
+    i++;
+  }
+  return len;
+}
+
+static void indexLines(long len) {
+  long cap = 1024;
+  starts = malloc(sizeof(long) * cap);
+  before = malloc(sizeof(long) * (cap + 1));
+  before[0] = 0;
+  for (long at = 0; at < len; nlines++) {
+    if (nlines + 1 >= cap) {
+      cap *= 2;
+      starts = realloc(starts, sizeof(long) * cap);
+      before = realloc(before, sizeof(long) * (cap + 1));
+    }
+    char *nl = memchr(text + at, '\n', len - at);
+    long width = nl - text - at;
+    starts[nlines] = at;
+    before[nlines + 1] = before[nlines] + (width > 0 ? (width - 1) / COLS + 1 : 1);
+    at += width + 1;
+  }
+}
+
+/* what screen line k of the wrapped file shows, as vtermLine reads it */
+static void expected(long k, char *buf) {
+  long lo = 0, hi = nlines;
+  while (hi - lo > 1) {
+    long mid = (lo + hi) / 2;
+    if (before[mid] <= k) lo = mid; else hi = mid;
+  }
+  if (k >= before[nlines]) {
+    strcpy(buf, "~");
+    return;
+  }
+  const char *p = text + starts[lo] + (k - before[lo]) * COLS;
+  const char *nl = strchr(p, '\n');
+  long n = nl - p < COLS ? nl - p : COLS;
+  // vtermLine leaves out trailing blanks
+  while (n > 0 && p[n - 1] == ' ')
+    n--;
+  memcpy(buf, p, n);
+  buf[n] = '\0';
+}
+
+/* the screen shows the wrapped file from screen line top, with the cursor on it */
+static void check(const char *what, long top) {
+  char want[COLS * 4 + 1], got[COLS * 4 + 1];
+  for (int y = 0; y < LINES; y++) {
+    expected(top + y, want);
+    vtermLine(term, y, got, sizeof(got));
+    if (strcmp(want, got) != 0) {
+      if (!failed)
+        printf("  %s, screen line %ld:\n  want %s\n  got  %s\n", what, top + y, want, got);
+      failed = 1;
+      return;
+    }
+  }
+  if (term->cy < 0 || term->cy >= LINES || term->cx < 0 || term->cx >= COLS) {
+    if (!failed)
+      printf("  %s: cursor at %d,%d is off the screen\n", what, term->cy, term->cx);
+    failed = 1;
+  }
+}
+
+static void report(const char *what, double *times, int n) {
+  qsort(times, n, sizeof(double), cmpDouble);
+  printf("%-28s %6d frames  p50 %.3f  p99 %.3f  max %.3f ms\n", what, n,
+         times[n / 2] * 1e3, times[n * 99 / 100] * 1e3, times[n - 1] * 1e3);
+}
+
+static double step(const char *keys) {
+  double t = now();
+  editorStep(keys, strlen(keys));
+  return now() - t;
+}
+
+int main(int argc, char *argv[]) {
+  long size = parseSize(argc > 1 ? argv[1] : "128M");
+  int pages = argc > 2 ? atoi(argv[2]) : 500;
+  long len = makeText(size);
+  indexLines(len);
+  FILE *fp = fopen(FILENAME, "w");
+  if (!fp || fwrite(text, 1, len, fp) != (size_t)len || fclose(fp) == EOF) {
+    perror(FILENAME);
+    return 1;
+  }
+  text[len] = '\0';
+
+  term = createVTerm(ROWS, COLS);
+  if (!term) { perror("createVTerm"); return 1; }
+  editorHeadless(term);
+  double t = now();
+  editorOpen(FILENAME);
+  editorStep(NULL, 0);
+  printf("%ld lines, %ld screen lines wrapped\n", nlines, before[nlines]);
+  printf("%-28s %.3f ms\n", "open", (now() - t) * 1e3);
+  printf("%-28s %.3f ms\n", "wrap on", step("\x17") * 1e3);
+  check("wrap on", 0);
+
+  double *times = malloc(sizeof(double) * pages);
+  for (int i = 0; i < pages; i++) {
+    times[i] = step("\x1b[6~");
+    check("page down", (long)(i + 1) * LINES);
+  }
+  report("page down", times, pages);
+
+  // the search puts the marker line at the top of the screen
+  long marker = 0;
+  while (marker < nlines && !memmem(text + starts[marker], 64, MARKER, strlen(MARKER)))
+    marker++;
+  t = now();
+  editorStep("\x06" MARKER "\r", 2 + strlen(MARKER));
+  printf("%-28s %.3f ms\n", "jump near the end", (now() - t) * 1e3);
+  check("jump", before[marker]);
+
+  int up = pages < before[marker] / LINES ? pages : before[marker] / LINES;
+  for (int i = 0; i < up; i++) {
+    times[i] = step("\x1b[5~");
+    check("page up", before[marker] - (long)(i + 1) * LINES);
+  }
+  if (up > 0)
+    report("page up", times, up);
+  printf("screens match the wrapped file: %s\n", failed ? "FAILED" : "ok");
+  free(times);
+  destroyVTerm(term);
+  return failed;
+}
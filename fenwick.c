@@ -0,0 +1,111 @@
+#include "fenwick.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* make room for n counts, returns 0 if that can't be allocated */
+static int fenwickReserve(Fenwick *f, ssize_t n) {
+  if (n <= f->cap)
+    return 1;
+  ssize_t cap = f->cap ? f->cap * 2 : 1024;
+  while (cap < n)
+    cap *= 2;
+  int64_t *tree = realloc(f->tree, sizeof(int64_t) * (cap + 1));
+  if (tree == NULL)
+    return 0;
+  f->tree = tree;
+  f->cap = cap;
+  return 1;
+}
+
+int fenwickFill(Fenwick *f, ssize_t n, int64_t count) {
+  if (!fenwickReserve(f, n))
+    return 0;
+  // entry i covers i & -i counts that are all the same
+  for (ssize_t i = 1; i <= n; i++)
+    f->tree[i] = count * (i & -i);
+  f->n = n;
+  return 1;
+}
+
+int fenwickPush(Fenwick *f, int64_t count) {
+  if (!fenwickReserve(f, f->n + 1))
+    return 0;
+  ssize_t i = f->n + 1;
+  f->tree[i] = count + fenwickSum(f, f->n) - fenwickSum(f, i - (i & -i));
+  f->n = i;
+  return 1;
+}
+
+void fenwickAdd(Fenwick *f, ssize_t i, int64_t delta) {
+  for (i++; i <= f->n; i += i & -i)
+    f->tree[i] += delta;
+}
+
+/*
+  Entries past at turned into the counts they hold and back. The entries
+  that make up entry j are j - k for every power of two k < (j & -j), so
+  each costs O(1) on average, and those up to at stay as they are.
+ */
+static void fenwickToCounts(Fenwick *f, ssize_t at) {
+  for (ssize_t j = f->n; j > at; j--)
+    for (ssize_t k = 1; k < (j & -j); k *= 2)
+      f->tree[j] -= f->tree[j - k];
+}
+
+static void fenwickFromCounts(Fenwick *f, ssize_t at) {
+  for (ssize_t j = at + 1; j <= f->n; j++)
+    for (ssize_t k = 1; k < (j & -j); k *= 2)
+      f->tree[j] += f->tree[j - k];
+}
+
+int fenwickInsert(Fenwick *f, ssize_t at, ssize_t n, int64_t count) {
+  if (!fenwickReserve(f, f->n + n))
+    return 0;
+  fenwickToCounts(f, at);
+  memmove(&f->tree[at + 1 + n], &f->tree[at + 1], sizeof(int64_t) * (f->n - at));
+  for (ssize_t j = at + 1; j <= at + n; j++)
+    f->tree[j] = count;
+  f->n += n;
+  fenwickFromCounts(f, at);
+  return 1;
+}
+
+void fenwickRemove(Fenwick *f, ssize_t at, ssize_t n) {
+  fenwickToCounts(f, at);
+  memmove(&f->tree[at + 1], &f->tree[at + 1 + n], sizeof(int64_t) * (f->n - at - n));
+  f->n -= n;
+  fenwickFromCounts(f, at);
+}
+
+int64_t fenwickSum(const Fenwick *f, ssize_t i) {
+  int64_t sum = 0;
+  for (; i > 0; i -= i & -i)
+    sum += f->tree[i];
+  return sum;
+}
+
+int64_t fenwickGet(const Fenwick *f, ssize_t i) {
+  return fenwickSum(f, i + 1) - fenwickSum(f, i);
+}
+
+ssize_t fenwickFind(const Fenwick *f, int64_t pos, int64_t *rest) {
+  ssize_t step = 1;
+  while (step * 2 <= f->n)
+    step *= 2;
+  // descend from the largest entry, taking every one that still fits
+  ssize_t i = 0;
+  for (; step > 0; step /= 2) {
+    if (i + step <= f->n && f->tree[i + step] <= pos) {
+      i += step;
+      pos -= f->tree[i];
+    }
+  }
+  *rest = pos;
+  return i;
+}
+
+void fenwickFree(Fenwick *f) {
+  free(f->tree);
+  f->tree = NULL;
+  f->n = f->cap = 0;
+}
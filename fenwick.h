@@ -0,0 +1,36 @@
+#ifndef FENWICK_H
+#define FENWICK_H
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+  Fenwick tree over a sequence of non-negative counts. Changing a count,
+  summing a prefix and finding the element a running sum falls in all
+  take O(log n), appending a count too. Entry i of the tree, counting
+  from 1, holds the sum of the i & -i counts ending at element i - 1.
+ */
+typedef struct {
+  int64_t *tree; // tree[0] is unused
+  ssize_t n;
+  ssize_t cap;
+} Fenwick;
+
+/* make f hold n counts that are all count, in O(n). Returns 0 if memory runs out. */
+int fenwickFill(Fenwick *f, ssize_t n, int64_t count);
+int fenwickPush(Fenwick *f, int64_t count);
+void fenwickAdd(Fenwick *f, ssize_t i, int64_t delta);
+/* insert n counts that are all count before element at, in O(f->n - at + n) */
+int fenwickInsert(Fenwick *f, ssize_t at, ssize_t n, int64_t count);
+/* remove counts [at, at + n), in O(f->n - at) */
+void fenwickRemove(Fenwick *f, ssize_t at, ssize_t n);
+/* sum of counts [0, i) */
+int64_t fenwickSum(const Fenwick *f, ssize_t i);
+int64_t fenwickGet(const Fenwick *f, ssize_t i);
+/*
+  Element that position pos of the running sum falls in: the last i with
+  fenwickSum(f, i) <= pos, with the rest of pos past that sum in *rest.
+  Returns f->n for positions past the total.
+ */
+ssize_t fenwickFind(const Fenwick *f, int64_t pos, int64_t *rest);
+void fenwickFree(Fenwick *f);
+#endif
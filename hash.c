@@ -0,0 +1,138 @@
+#include "hash.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define P1 0x9e3779b185ebca87ULL
+#define P2 0xc2b2ae3d27d4eb4fULL
+#define P3 0x165667b19e3779f9ULL
+#define P32 0x9e3779b1U
+
+/*
+  Key words mixed into the stripes: stripe s of a round uses key[s] to
+  key[s + 7], so the same text at another place in a round hashes
+  differently. key[16] to key[23] scramble the lanes after each round.
+ */
+static const uint64_t key[24] = {
+  0xa397ff2024ed8810ULL, 0x7588af7f6d46224aULL, 0x9c88b42085f4c341ULL,
+  0x1a1ed9bddeb1d841ULL, 0x84bd925b0164bfb4ULL, 0xa4df71a7abb3ef5dULL,
+  0x507a7eca7bcb9d7cULL, 0xcecb593be292beffULL, 0x6280b97aa9e838b3ULL,
+  0xc0a51282849f746aULL, 0xa1052b5bf0943b1dULL, 0x50db7d102677451fULL,
+  0xe55d2bf51eb92a8cULL, 0xfd7f824431e707e4ULL, 0x710b707d65e0fb85ULL,
+  0x90e55cc667557c15ULL, 0x399ebe0940dbe1dbULL, 0x427ef96c69b52d52ULL,
+  0x43f9d293dc9cedd9ULL, 0x42a090c11487cabbULL, 0xde9b23a20871a887ULL,
+  0x7cdab87c5114bc73ULL, 0x579508eed0420534ULL, 0x6930c34ef2850f41ULL,
+};
+
+static uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t load64(const unsigned char *p) {
+  uint64_t w;
+  memcpy(&w, p, 8);
+  return w;
+}
+
+/*
+  Add n stripes to the lanes, the first using key word k: each word is
+  mixed with its key word and its two halves multiplied into its lane,
+  and the word itself is added to the neighbouring lane.
+ */
+static void hashStripes(uint64_t *acc, const unsigned char *p, size_t n, int k) {
+#ifdef __SSE2__
+  __m128i a[4];
+  for (int j = 0; j < 4; j++)
+    a[j] = _mm_loadu_si128((const __m128i *)(acc + 2 * j));
+  for (size_t s = 0; s < n; s++, p += HASH_STRIPE) {
+    for (int j = 0; j < 4; j++) {
+      __m128i d = _mm_loadu_si128((const __m128i *)(p + 16 * j));
+      __m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *)(key + k + s + 2 * j)));
+      __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+      __m128i swap = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+      a[j] = _mm_add_epi64(a[j], _mm_add_epi64(prod, swap));
+    }
+  }
+  for (int j = 0; j < 4; j++)
+    _mm_storeu_si128((__m128i *)(acc + 2 * j), a[j]);
+#else
+  for (size_t s = 0; s < n; s++, p += HASH_STRIPE) {
+    for (int i = 0; i < 8; i++) {
+      uint64_t d = load64(p + 8 * i);
+      uint64_t dk = d ^ key[k + s + i];
+      acc[i] += (dk & 0xffffffff) * (dk >> 32);
+      acc[i ^ 1] += d;
+    }
+  }
+#endif
+}
+
+/* keep the lanes from piling up low entropy bits between rounds */
+static void hashScramble(uint64_t *acc) {
+  for (int i = 0; i < 8; i++)
+    acc[i] = (acc[i] ^ (acc[i] >> 47) ^ key[16 + i]) * P32;
+}
+
+static void hashRounds(Hasher *h, const unsigned char *p, size_t n) {
+  for (size_t i = 0; i < n; i++, p += HASH_ROUND) {
+    hashStripes(h->acc, p, HASH_ROUND / HASH_STRIPE, 0);
+    hashScramble(h->acc);
+  }
+}
+
+void hashInit(Hasher *h) {
+  for (int i = 0; i < 8; i++)
+    h->acc[i] = i & 1 ? P1 * (i + 1) : P2 * (i + 1);
+  h->buflen = 0;
+  h->len = 0;
+}
+
+void hashUpdate(Hasher *h, const char *s, size_t len) {
+  const unsigned char *p = (const unsigned char *)s;
+  h->len += len;
+  if (h->buflen > 0) {
+    size_t take = HASH_ROUND - h->buflen < len ? HASH_ROUND - h->buflen : len;
+    memcpy(h->buf + h->buflen, p, take);
+    h->buflen += take;
+    p += take;
+    len -= take;
+    if (h->buflen < HASH_ROUND)
+      return;
+    hashRounds(h, h->buf, 1);
+    h->buflen = 0;
+  }
+  hashRounds(h, p, len / HASH_ROUND);
+  memcpy(h->buf, p + len / HASH_ROUND * HASH_ROUND, len % HASH_ROUND);
+  h->buflen = len % HASH_ROUND;
+}
+
+uint64_t hashFinal(const Hasher *h) {
+  uint64_t acc[8];
+  memcpy(acc, h->acc, sizeof(acc));
+  // whole stripes of the last round, then the bytes short of a stripe
+  size_t stripes = h->buflen / HASH_STRIPE;
+  hashStripes(acc, h->buf, stripes, 0);
+  uint64_t x = h->len * P1;
+  for (int i = 0; i < 8; i++)
+    x = rotl(x ^ acc[i] * P2, 31) * P1;
+  size_t i = stripes * HASH_STRIPE;
+  for (; i + 8 <= h->buflen; i += 8)
+    x = rotl(x ^ load64(h->buf + i) * P2, 27) * P1 + P3;
+  for (; i < h->buflen; i++)
+    x = rotl(x ^ h->buf[i] * P3, 11) * P1;
+  // spread every input bit over the whole result
+  x ^= x >> 33;
+  x *= P2;
+  x ^= x >> 29;
+  x *= P3;
+  x ^= x >> 32;
+  return x;
+}
+
+uint64_t hashBytes(const char *s, size_t len) {
+  Hasher h;
+  hashInit(&h);
+  hashUpdate(&h, s, len);
+  return hashFinal(&h);
+}
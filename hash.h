@@ -0,0 +1,27 @@
+#ifndef HASH_H
+#define HASH_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  64 bit hash of a byte stream for noticing changed file blocks, not for
+  anything adversarial. It runs at memory speed: eight 64 bit lanes take
+  a 64 byte stripe at a time with one 32x32 bit multiply per word, two
+  lanes per instruction with SSE2 where it is available. Text can be fed
+  in pieces of any size with the same result as hashing it in one go.
+ */
+#define HASH_STRIPE 64
+#define HASH_ROUND (16 * HASH_STRIPE) // stripes between scrambles of the lanes
+
+typedef struct {
+  uint64_t acc[8];
+  unsigned char buf[HASH_ROUND]; // bytes short of a whole round
+  size_t buflen;
+  uint64_t len;
+} Hasher;
+
+void hashInit(Hasher *h);
+void hashUpdate(Hasher *h, const char *s, size_t len);
+uint64_t hashFinal(const Hasher *h);
+uint64_t hashBytes(const char *s, size_t len);
+#endif
@@ -0,0 +1,57 @@
+#define _DEFAULT_SOURCE
+#include "hist.h"
+#include <inttypes.h>
+
+static int histIndex(uint64_t v) {
+  if (v < HIST_SUB)
+    return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  int sub = (int)(v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1);
+  return (e - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+/* largest value that falls into bucket i */
+static uint64_t histUpper(int i) {
+  if (i < HIST_SUB)
+    return i;
+  int e = i / HIST_SUB + HIST_SUB_BITS - 1;
+  uint64_t sub = i % HIST_SUB;
+  uint64_t width = (uint64_t)1 << (e - HIST_SUB_BITS);
+  return ((HIST_SUB + sub) << (e - HIST_SUB_BITS)) + width - 1;
+}
+
+void histRecord(Histogram *h, uint64_t v) {
+  h->counts[histIndex(v)]++;
+  h->n++;
+  h->sum += v;
+  if (v > h->max)
+    h->max = v;
+}
+
+uint64_t histPercentile(const Histogram *h, double p) {
+  if (h->n == 0)
+    return 0;
+  uint64_t want = (uint64_t)(h->n * p / 100.0 + 0.5);
+  if (want < 1)
+    want = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= want) {
+      uint64_t upper = histUpper(i);
+      return upper < h->max ? upper : h->max;
+    }
+  }
+  return h->max;
+}
+
+void histDump(const Histogram *h, const char *name, FILE *fp) {
+  fprintf(fp, "%s n=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64 " p90=%" PRIu64
+          " p99=%" PRIu64 " p999=%" PRIu64 " max=%" PRIu64 "\n",
+          name, h->n, h->n ? h->sum / h->n : 0, histPercentile(h, 50),
+          histPercentile(h, 90), histPercentile(h, 99), histPercentile(h, 99.9),
+          h->max);
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    if (h->counts[i])
+      fprintf(fp, "%s le=%" PRIu64 " %" PRIu64 "\n", name, histUpper(i), h->counts[i]);
+}
@@ -1,3 +1,7 @@
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,43 +11,300 @@
 #include <string.h>
 #include <sys/types.h>
 #include "logger.h"
+#include "arena.h"
+#include "search.h"
+#include "pool.h"
+#include "regexdfa.h"
+#include "syntax.h"
+#include "utf8.h"
+#include "vterm.h"
+#include "hist.h"
+#include "hash.h"
+#include "fenwick.h"
+#include "kilo.h"
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
 
 /*** defines for kilo editor***/
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
+#define KILO_LAZY_THRESHOLD (64 * 1024 * 1024) // files this big are mapped instead of read
+#define KILO_LINE_BLOCK 1024 // rows per line index entry of a mapped file
+#define KILO_LOAD_CHUNK (4 * 1024 * 1024) // bytes per task when loading a file
+#define KILO_SAVE_BATCH 256 // rows per writev while saving, 3 iovecs each must fit IOV_MAX
+#define KILO_SAVE_POLL 100 // ms between progress updates of a running save
+#define KILO_SEARCH_TASK (16 * KILO_LINE_BLOCK) // rows per whole file search task
+#define KILO_SEARCH_POLL 20 // ms between checks for a key that cancels a search
+#define KILO_ESC_TIMEOUT 50 // ms to wait for the rest of an escape sequence
+#define KILO_WRITEV 1 // send changed lines straight from the shadow with writev
+#define KILO_HL_SYNC 256 // rows lexed above the screen when jumping past highlighted rows
+#define KILO_FOLLOW_POLL 33 // ms between looks at a followed file, bounds redraws while it grows
+#define KILO_FOLLOW_MAX (64 * 1024 * 1024) // bytes of a followed file appended per look
+#define KILO_CHANGE_POLL 1000 // ms between looks for changes by other programs without inotify
+#define KILO_HASH_BLOCK (64 * 1024) // bytes per block hash of the file, divides KILO_LOAD_CHUNK
+#define KILO_UNDO_BLOCK (64 * 1024) // bytes per block of the undo journal
 #define KILO_QUIT_TIMES 3 // requires user to quit 3 more times in order to quit without saving the changes.
 
 /*** prototypes ***/
+void editorPerfDump();
 void editorSetStatusMessage(const char *fmt, ...);
+void editorInvalidateScreen();
+void editorRefreshScreen();
+void editorSaveCheck(int wait);
+int editorFileWait();
+void editorWatch();
+void editorFollowOpen(ssize_t offset);
+void editorWrapInvalidate();
+void editorWrapRows(ssize_t at, ssize_t removed, ssize_t inserted);
+void editorWrapPage(int key);
+void editorScroll();
+void editorSetWrap(int on);
+char *editorPrompt(char *prompt, void (*callback)(char *, int));
+struct abuf;
+void abAppend(struct abuf *ab, const char *s, ssize_t len);
+ssize_t writevAll(int fd, struct iovec *iov, int cnt);
 
 // The CTRL_KEY macro bitwise-ANDs a character with the value 00011111, in binary.
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 /*** data ***/
+/*
+  Chars of a row whose columns differ from their bytes, in order: tabs
+  (len 1) and multibyte chars. rx is the column the char starts at.
+ */
+typedef struct colchar {
+  ssize_t cx;
+  ssize_t rx;
+  int len; // bytes
+  int width; // columns
+} colchar;
+
+typedef struct colindex {
+  ssize_t n;
+  ssize_t cap;
+  colchar c[];
+} colindex;
+
 // This repersents a single row of data/file
+/*
+  chars is a gap buffer: the text lives in chars[0, gap) and
+  chars[gap + gaplen, size + gaplen), the bytes in between are free space.
+  Inserts and deletes happen at the gap, so typing at the cursor only moves
+  the gap when the cursor jumps and costs amortized O(1) per key.
+ */
 typedef struct erow {
-  int size;
-  int rsize; // size of render chars
+  ssize_t size; // number of chars, excluding the gap
+  ssize_t rsize; // size of render chars
+  ssize_t gap; // start of the gap in chars
+  ssize_t gaplen; // free bytes in the gap
+  int rstale; // render is out of date with chars
+  int ascii; // no bytes >= 0x80, so every byte of render is one column
+  int borrowed; // chars lives in E.arena or E.map and is copied out on first edit
+  int shared; // chars is owned but read by a running save, see editorSave
   char *chars;
   char *render; // used to keep tabs and unprintable characters
+  int rshared; // render is chars itself, the row needs no expansion
+  colindex *cols; // maps cx to rx and back, NULL if every byte is a column
+  int colstale; // cols has to be rebuilt before it is used
+  unsigned char *hl; // highlight class of each render char, see syntax.h
+  int hlin; // lexer state hl was computed from, -1 if hl is out of date
+  int hlstate; // lexer state at the end of the row
 } erow;
 
+/* append buffer, used to refresh editor in 1 step */
+struct abuf {
+  char *b;
+  ssize_t len;
+  ssize_t cap; // bytes allocated in b
+};
+
+#define ABUF_INIT                                                              \
+  { NULL, 0, 0 }
+
+/* a part of the next frame: len bytes of src starting at off */
+typedef struct framepiece {
+  struct abuf *src;
+  ssize_t off;
+  ssize_t len;
+} framepiece;
+
+/*
+  One edit in the undo journal: len bytes of text inserted or deleted at
+  row y, column x. Line breaks in text are '\n'. The text lives in
+  E.undolog, typed runs of chars grow in place there.
+ */
+enum undoType { UNDO_INSERT, UNDO_DELETE };
+
+typedef struct undoOp {
+  int type;
+  ssize_t y, x;
+  ssize_t len;
+  int newrow; // the insert appended row y first
+  char *text;
+} undoOp;
+
+/*
+  Phases of turning a key into a frame, each timed into a histogram of
+  nanoseconds. A frame runs from the first key after the last refresh
+  being available to the frame being written. PERF_BYTES holds bytes
+  written per refresh instead of times.
+ */
+enum perfPhase {
+  PERF_READ, // decoding a key once its bytes have arrived
+  PERF_PROCESS, // applying a key, up to the next read or refresh
+  PERF_SCROLL,
+  PERF_DRAW, // composing the frame
+  PERF_WRITE,
+  PERF_FRAME,
+  PERF_BYTES,
+  PERF_PHASES
+};
+
+static const char *perfNames[PERF_PHASES] = {
+  "read", "process", "scroll", "draw", "write", "frame", "bytes"
+};
+
+/* a row as it was when a save started */
+typedef struct saverow {
+  char *chars;
+  ssize_t size;
+  ssize_t gap;
+  ssize_t gaplen;
+} saverow;
+
+/*
+  A block of the file as it was read or saved, from off to the start of
+  the next one, and the hash of its bytes. See editorReload.
+ */
+typedef struct hashBlock {
+  size_t off;
+  uint64_t hash;
+} hashBlock;
+
+/* a save running on a background thread */
+typedef struct saveJob {
+  pthread_t thread;
+  char *filename;
+  saverow *rows; // snapshot of the document
+  ssize_t numrows;
+  ssize_t total; // bytes to write
+  ssize_t written; // bytes written so far, updated by the saver thread
+  int done; // set by the saver thread when it has finished
+  int err; // errno of the failure, 0 on success
+  int dirty; // E.dirty when the snapshot was taken
+  hashBlock *hashes; // blocks of the written file, see editorSaveHash
+  Hasher hasher; // hash of the block being written
+  ssize_t hashfill; // bytes of it written so far
+  ssize_t nhashes;
+} saveJob;
+
 // global config of the edtiro
 struct editorConfig {
-  int cx, cy; // cursor x and y position in the file.
-  int rx; //cursor position in render
+  ssize_t cx, cy; // cursor x and y position in the file.
+  ssize_t rx; //cursor position in render
   int screenrows; // total rows in the screen
   int screencols; // total columns in the screen
-  int numrows; // total number of rows that are filled with data
-  int rowoff;  // row offset from the top, while scrolling vertically
-  int coloff; // column offset from the left to scroll horizontally
+  ssize_t numrows; // total number of rows that are filled with data
+  ssize_t rowcap; // number of rows allocated in row
+  ssize_t rowoff;  // row offset from the top, while scrolling vertically
+  ssize_t coloff; // column offset from the left to scroll horizontally
+  int wrap; // long rows are soft wrapped at the screen width instead of scrolled
+  ssize_t wrapoff; // screen lines of row rowoff above the screen while wrapping
+  Fenwick wraplines; // screen lines of every row while wrapping, see editorWrapIndex
+  int wrapcols; // screen width wraplines was built for, 0 once it has to be rebuilt
+  int wrapy, wrapx; // cursor on screen while wrapping, set by editorScroll
   erow *row; // all rows
+  Arena *arena; // text of rows loaded from file
+  char *map; // read-only mapping of a large file, rows point into it
+  size_t mapsize;
+  ssize_t maprows; // rows [0, maprows) are materialized from map on demand
+  size_t *lineidx; // offset of every KILO_LINE_BLOCK'th line in map
+  int mapstale; // a save replaced the file map was made of, so it no longer changes with it
+  char *blockloaded; // which blocks of KILO_LINE_BLOCK rows are materialized
   struct termios orig_termios; // original terminal settings
+  VTerm *term; // in-memory terminal of a headless editor, NULL on a tty
+  FILE *record; // keys read from the tty are appended here as a replay script
+  const char *feed; // keys of the headless step not yet in inbuf
+  int feedlen;
+  int quit; // ^Q was pressed in a headless editor
+  char inbuf[65536]; // raw input not yet decoded into keys
+  int inlen;
+  int inpos; // next byte of inbuf to decode
+  struct abuf paste; // text of the bracketed paste being read
   Logger *logger;
   char *filename;
+  ssize_t filesize; // bytes of the file read into rows, -1 if it isn't a regular file
+  int follow; // rows are appended as the file grows, see editorFollowCheck
+  int followfd; // the followed file, -1 when not following
+  struct stat filestat; // the file as it was last read or saved
+  hashBlock *hashes; // the file as read or saved, in blocks of up to KILO_HASH_BLOCK bytes
+  ssize_t nhashes;
+  ssize_t hashcap;
+  int changed; // another program changed the file under unsaved edits
+  int clobber; // the next save may overwrite the file even though it changed
+  int watchfd; // inotify descriptor woken when the file changes, -1 if there is none
+  int fileready; // the file may have changed since it was last looked at
+  int followpartial; // the last row has no line break yet, new bytes continue it
+  uint64_t filetime; // when it was last looked at
+  saveJob *save; // running save, NULL if there is none
+  char **retired; // buffers of shared rows that were copied out while saving
+  int nretired;
+  int retiredcap;
+  struct abuf frame; // escape sequences of the frame being built
+  struct abuf line; // scratch for composing one screen line
+  framepiece *pieces; // frame and shadow ranges to write, in order
+  int npieces;
+  int piececap;
+  ssize_t framemark; // start of the frame bytes not yet in pieces
+  struct abuf *shadow; // lines drawn in the previous frame
+  int shadowrows;
+  int fullredraw; // ignore shadow and redraw every line
+  long framebytes; // bytes written by the last refresh
+  long totalbytes; // bytes written by all refreshes
+  long frames;
+  Histogram perf[PERF_PHASES]; // see perfPhase
+  uint64_t perfframe; // start of the frame being timed, 0 if none
+  uint64_t perfkey; // when the key being processed was read, 0 if none
+  int perfshow; // ^P shows frame times in the status bar
+  char *perfdump; // file the histograms are written to on quit
+  char *findquery; // query of a running search, its matches are highlighted
+  size_t findlen;
+  ssize_t findrow, findcol; // current match, findrow is -1 if there is none
+  ssize_t findorigrow, findorigcol; // cursor when the search started
+  size_t findprevlen; // query length at the previous key
+  long findcount; // matches of the query in the file, -1 if not known
+  int findisregex; // the query is a regular expression
+  Regex *findregex; // compiled query, NULL while it doesn't compile
+  const char *finderr; // why the query doesn't compile
+  const Syntax *syntax; // language of the file, NULL for plain text
+  ssize_t hlvalid; // rows above this one have hl matching the state of the row before
+  Arena *undolog; // text of undo records, append only
+  undoOp *undo; // edits in order, [0, undopos) are applied
+  int nundo;
+  int undocap;
+  int undopos;
+  int undoopen; // the last record is a run that typing may extend
+  int replaying; // undo or redo is editing, don't record it
+  long undobytes; // journal text bytes, including undone records
+  ThreadPool *pool; // workers for loading and whole file searches
+  ssize_t *panelrows; // rows listed by editorGrep, NULL when the panel is closed
+  ssize_t panelcount;
+  ssize_t panelsel; // selected entry
+  ssize_t paneloff; // first entry on screen
   char statusmsg[80];
   time_t statusmsg_time;
   int dirty;
@@ -60,11 +321,46 @@ enum editorKey {
   PAGE_DOWN,
   HOME_KEY,
   END_KEY,
-  DEL_KEY
+  DEL_KEY,
+  PASTE_START, // start of a bracketed paste
+  NO_KEY // nothing was pressed, the main loop woke up for other work
 };
 
 
-struct editorConfig E;
+// nothing is watched or followed yet, also for callers that skip initEditor
+struct editorConfig E = {.followfd = -1, .watchfd = -1};
+
+/*** performance ***/
+/* record the time from *start to now into phase if a timer is running and stop it */
+void editorPerfEnd(uint64_t *start, int phase, uint64_t now) {
+  if (*start) {
+    histRecord(&E.perf[phase], now - *start);
+    *start = 0;
+  }
+}
+
+/* record the time since start into phase, returns now for the next phase */
+uint64_t editorPerfLap(int phase, uint64_t start) {
+  uint64_t now = histNow();
+  histRecord(&E.perf[phase], now - start);
+  return now;
+}
+
+void editorSetPerfDump(char *filename) {
+  E.perfdump = filename;
+}
+
+/* write every histogram to E.perfdump, times in ns */
+void editorPerfDump() {
+  if (!E.perfdump)
+    return;
+  FILE *fp = fopen(E.perfdump, "w");
+  if (!fp)
+    return;
+  for (int i = 0; i < PERF_PHASES; i++)
+    histDump(&E.perf[i], perfNames[i], fp);
+  fclose(fp);
+}
 
 /*** terminal ***/
 void die(const char *s) {
@@ -76,6 +372,14 @@ void die(const char *s) {
   exit(1);
 }
 
+/* set on SIGWINCH, the size is read again before the next frame, see editorCheckResize */
+static volatile sig_atomic_t winchanged = 0;
+
+static void handleWinch(int sig) {
+  (void)sig;
+  winchanged = 1;
+}
+
 
 /*
  * disableRawMode(): Restores the terminal to its original settings
@@ -98,6 +402,8 @@ void die(const char *s) {
  * Can also be called manually if needed
  */
 void disableRawMode() {
+  // turn bracketed paste off again
+  write(STDOUT_FILENO, "\x1b[?2004l", 8);
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
     die("tcsetattr");
   }
@@ -120,65 +426,242 @@ void enableRawMode() {
   raw.c_oflag &= ~(OPOST);
   // local flags
   raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+  // reads never block, the event loop waits for input with poll()
   raw.c_cc[VMIN] = 0;
-  raw.c_cc[VTIME] = 1;
+  raw.c_cc[VTIME] = 0;
 
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+  /*
+    Bracketed paste: the terminal wraps pasted text in ESC [200~ and
+    ESC [201~, so it can be inserted as one block instead of key by key.
+   */
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey() {
-  int nread;
-  char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (nread == -1 && errno != EAGAIN) die("read");
+/*
+  Escape sequences the terminal sends for special keys. The decoder looks
+  input up in this table instead of reading the sequence byte by byte.
+ */
+static const struct {
+  const char *seq;
+  int key;
+} editorKeyTable[] = {
+  /*
+    an arrow key sends multiple bytes as input to our program.
+    These bytes are in the form of an escape sequence that starts with
+    '\x1b', '[', followed by an 'A', 'B', 'C', or 'D' depending on which of the four arrow keys was pressed.
+   */
+  {"\x1b[A", ARROW_UP},
+  {"\x1b[B", ARROW_DOWN},
+  {"\x1b[C", ARROW_RIGHT},
+  {"\x1b[D", ARROW_LEFT},
+  {"\x1bOA", ARROW_UP},
+  {"\x1bOB", ARROW_DOWN},
+  {"\x1bOC", ARROW_RIGHT},
+  {"\x1bOD", ARROW_LEFT},
+  //Page Up is sent as <esc>[5~ and Page Down is sent as <esc>[6~.
+  {"\x1b[5~", PAGE_UP},
+  {"\x1b[6~", PAGE_DOWN},
+  {"\x1b[3~", DEL_KEY},
+  {"\x1b[1~", HOME_KEY},
+  {"\x1b[7~", HOME_KEY},
+  {"\x1b[H", HOME_KEY},
+  {"\x1bOH", HOME_KEY},
+  {"\x1b[4~", END_KEY},
+  {"\x1b[8~", END_KEY},
+  {"\x1b[F", END_KEY},
+  {"\x1bOF", END_KEY},
+  {"\x1b[200~", PASTE_START},
+};
+
+/*
+  Decode one key from buf. Returns the number of bytes used, or 0 if buf
+  holds only the start of an escape sequence and more input is needed.
+ */
+int editorDecodeKey(const char *buf, int len, int *key) {
+  if (buf[0] != '\x1b') {
+    *key = (unsigned char)buf[0];
+    return 1;
+  }
+  int prefix = 0;
+  for (size_t i = 0; i < sizeof(editorKeyTable) / sizeof(editorKeyTable[0]); i++) {
+    const char *seq = editorKeyTable[i].seq;
+    int seqlen = strlen(seq);
+    int n = len < seqlen ? len : seqlen;
+    if (memcmp(buf, seq, n) != 0)
+      continue;
+    if (n == seqlen) {
+      *key = editorKeyTable[i].key;
+      return seqlen;
+    }
+    prefix = 1;
+  }
+  if (prefix)
+    return 0;
+  // skip over a control sequence we don't know about
+  if (len >= 2 && buf[1] == '[') {
+    int i = 2;
+    while (i < len && (buf[i] < 0x40 || buf[i] > 0x7e))
+      i++;
+    if (i == len)
+      return 0;
+    *key = '\x1b';
+    return i + 1;
   }
+  *key = '\x1b';
+  return 1;
+}
 
-  if (c == '\x1b') {
-    char seq[3];
-    if (read(STDOUT_FILENO, &seq[0], 1) != 1)
-      return '\x1b';
-    if (read(STDOUT_FILENO, &seq[1], 1) != 1)
+/*
+  Wait up to timeout ms (-1 forever) for input and read all that is
+  available in one go. Returns the number of bytes read.
+ */
+int editorFillInput(int timeout) {
+  if (E.inpos > 0) {
+    memmove(E.inbuf, &E.inbuf[E.inpos], E.inlen - E.inpos);
+    E.inlen -= E.inpos;
+    E.inpos = 0;
+  }
+  if (E.inlen == (int)sizeof(E.inbuf))
+    return 0;
+  // a headless editor reads the keys passed to editorStep instead
+  if (E.term) {
+    int n = sizeof(E.inbuf) - E.inlen;
+    if (n > E.feedlen)
+      n = E.feedlen;
+    if (n == 0)
+      return 0;
+    memcpy(&E.inbuf[E.inlen], E.feed, n);
+    E.inlen += n;
+    E.feed += n;
+    E.feedlen -= n;
+    return n;
+  }
+  struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {E.watchfd, POLLIN, 0}};
+  int nfds = 1;
+  if (E.filesize >= 0 && !E.fileready) {
+    // the file is looked at once every editorFileWait() ms at most
+    int wait = editorFileWait();
+    if (wait <= 0 && E.watchfd != -1)
+      nfds = 2;
+    else if (timeout < 0 || timeout > wait)
+      timeout = wait > 0 ? wait : 0;
+  }
+  int ready = poll(pfd, nfds, timeout);
+  if (ready == -1) {
+    if (errno == EINTR)
+      return 0;
+    die("poll");
+  }
+  // without inotify the file is looked at whenever the wait is over
+  if (E.filesize >= 0 && E.watchfd == -1 && editorFileWait() <= 0)
+    E.fileready = 1;
+  if (nfds == 2 && pfd[1].revents) {
+    char events[4096];
+    while (read(E.watchfd, events, sizeof(events)) > 0)
+      ;
+    E.fileready = 1;
+  }
+  if (!(pfd[0].revents & POLLIN))
+    return 0;
+  int nread = read(STDIN_FILENO, &E.inbuf[E.inlen], sizeof(E.inbuf) - E.inlen);
+  if (nread == -1) {
+    if (errno == EAGAIN || errno == EINTR)
+      return 0;
+    die("read");
+  }
+  if (E.record)
+    editorRecordKeys(&E.inbuf[E.inlen], nread);
+  E.inlen += nread;
+  return nread;
+}
+
+/* decode the next key from the input buffer, returns 0 if there is none yet */
+int editorNextKey(int *key) {
+  int avail = E.inlen - E.inpos;
+  if (avail == 0)
+    return 0;
+  int used = editorDecodeKey(&E.inbuf[E.inpos], avail, key);
+  if (used == 0) {
+    /*
+      a partial escape sequence: give the rest of it a moment to arrive,
+      if it doesn't this was the Escape key on its own
+     */
+    if (editorFillInput(KILO_ESC_TIMEOUT) > 0)
+      return editorNextKey(key);
+    *key = '\x1b';
+    used = 1;
+  }
+  E.inpos += used;
+  return 1;
+}
+
+/*
+  Wait for the next key. While a save runs in the background, returns
+  NO_KEY every KILO_SAVE_POLL ms so the screen can show its progress,
+  when the file may have been changed or grown and when the terminal
+  was resized.
+ */
+int editorReadKey() {
+  int key;
+  uint64_t start = histNow();
+  editorPerfEnd(&E.perfkey, PERF_PROCESS, start);
+  while (!editorNextKey(&key)) {
+    int n = editorFillInput(E.term ? 0 : E.save ? KILO_SAVE_POLL : -1);
+    // time spent waiting for the user is not latency
+    start = histNow();
+    if (n == 0 && (E.save || E.fileready || winchanged))
+      return NO_KEY;
+    // a replay that ran out of keys cancels the prompt waiting for one
+    if (n == 0 && E.term)
       return '\x1b';
-    if (seq[0] == '[') {
-      //Page Up is sent as <esc>[5~ and Page Down is sent as <esc>[6~.
-      if (seq[1] > '0' && seq[1] <= '9') {
-        if (read(STDOUT_FILENO, &seq[2], 1) != 1)
-          return '\x1b';
-        if (seq[2] == '~') {
-          switch (seq[1]) {
-          case '3':
-            return DEL_KEY;
-          case '5':
-            return PAGE_UP;
-          case '6':
-            return PAGE_DOWN;
-          }
-        }
-      } else {
-        /*
-          an arrow key sends multiple bytes as input to our program.
-          These bytes are in the form of an escape sequence that starts with
-          '\x1b', '[', followed by an 'A', 'B', 'C', or 'D' depending on which of the four arrow keys was pressed.
-         */
-        switch (seq[1]) {
-        case 'A':
-          return ARROW_UP;
-        case 'B':
-          return ARROW_DOWN;
-        case 'C':
-          return ARROW_RIGHT;
-        case 'D':
-          return ARROW_LEFT;
-        }
-      }
-    }
+  }
+  E.perfkey = histNow();
+  histRecord(&E.perf[PERF_READ], E.perfkey - start);
+  if (!E.perfframe)
+    E.perfframe = start;
+  return key;
+}
 
-    return '\x1b';
-  } else {
-    return c;
+/*
+  Read the rest of a bracketed paste, up to the closing ESC [201~, into
+  E.paste. Gives up if the terminal stops sending for a second.
+ */
+void editorReadPaste() {
+  static const char endseq[] = "\x1b[201~";
+  int endlen = sizeof(endseq) - 1;
+  E.paste.len = 0;
+  while (1) {
+    char *start = &E.inbuf[E.inpos];
+    int avail = E.inlen - E.inpos;
+    char *end = memmem(start, avail, endseq, endlen);
+    if (end) {
+      abAppend(&E.paste, start, end - start);
+      E.inpos += (end - start) + endlen;
+      return;
+    }
+    // keep what could be the start of the end sequence
+    int take = avail - (endlen - 1);
+    if (take > 0) {
+      abAppend(&E.paste, start, take);
+      E.inpos += take;
+    }
+    if (editorFillInput(1000) == 0) {
+      abAppend(&E.paste, &E.inbuf[E.inpos], E.inlen - E.inpos);
+      E.inpos = E.inlen;
+      return;
+    }
   }
+}
 
-  return c;
+/*
+  True if more keys are already waiting, so the main loop can apply them
+  all before drawing once. Never blocks.
+ */
+int editorKeyPending() {
+  if (E.inpos == E.inlen)
+    editorFillInput(0);
+  return E.inpos < E.inlen;
 }
 
 /**
@@ -201,7 +684,9 @@ int getCursorPosition(int *rows, int *cols) {
     // Read the response one character at a time
     // Response format will be: \x1b[rows;colsR
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        // reads don't wait in raw mode, give the terminal time to answer
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, 100) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1)
             break;
         if (buf[i] == 'R')      // 'R' marks the end of the response
             break;
@@ -247,123 +732,844 @@ int getWindowSize(int *rows, int *cols) {
   }
 }
 
+/*
+  Take the new size of a resized terminal. Every line is drawn again, and
+  the soft wrap index is rebuilt for a new width when it is next used.
+ */
+void editorCheckResize() {
+  if (!winchanged)
+    return;
+  winchanged = 0;
+  int rows, cols;
+  if (getWindowSize(&rows, &cols) == -1)
+    return;
+  E.screenrows = rows - 2;
+  E.screencols = cols;
+  editorInvalidateScreen();
+}
+
 
 
 /*** row operations ***/
 
+void editorLoadBlock(ssize_t block);
+void editorMaterializeRows();
+void editorRowReserve(erow *row, ssize_t need);
+
+/*
+  Return row at. Rows of a mapped file are materialized a block at a time
+  the first time anything looks at them.
+ */
+erow *editorRow(ssize_t at) {
+  if (at < E.maprows && !E.blockloaded[at / KILO_LINE_BLOCK])
+    editorLoadBlock(at / KILO_LINE_BLOCK);
+  return &E.row[at];
+}
+
+/* char at logical position at, skipping over the gap */
+#define ROW_CHAR(row, at)                                                      \
+  ((row)->chars[(at) < (row)->gap ? (at) : (at) + (row)->gaplen])
+
+/*
+  Move the gap so that it starts at logical position at.
+  Only the bytes between the old and the new gap position are moved,
+  so consecutive edits at the same place don't move anything.
+ */
+void editorRowMoveGap(erow *row, ssize_t at) {
+  if (at == row->gap)
+    return;
+  // borrowed text is read-only, the row needs its own copy first
+  if (row->borrowed)
+    editorRowReserve(row, 0);
+  if (at < row->gap) {
+    ssize_t n = row->gap - at;
+    memmove(&row->chars[at + row->gaplen], &row->chars[at], n);
+  } else if (at > row->gap) {
+    ssize_t n = at - row->gap;
+    memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], n);
+  }
+  row->gap = at;
+}
+
+/* free buf once the running save that reads it has finished */
+void editorRetire(char *buf) {
+  if (E.nretired == E.retiredcap) {
+    E.retiredcap = E.retiredcap ? E.retiredcap * 2 : 64;
+    E.retired = realloc(E.retired, sizeof(char *) * E.retiredcap);
+    if (E.retired == NULL)
+      die("realloc");
+  }
+  E.retired[E.nretired++] = buf;
+}
+
+/* make sure the gap has room for at least need more chars */
+void editorRowReserve(erow *row, ssize_t need) {
+  if (!row->borrowed && row->gaplen >= need)
+    return;
+  ssize_t cap = row->size + row->gaplen;
+  ssize_t newcap = cap ? cap * 2 : 16;
+  while (newcap - row->size < need)
+    newcap *= 2;
+  char *new;
+  // a render sharing chars can't follow it to the new block
+  if (row->rshared) {
+    row->render = NULL;
+    row->rsize = 0;
+    row->rshared = 0;
+    row->rstale = 1;
+  }
+  if (row->borrowed) {
+    // arena text can't be resized, take a private copy of it
+    new = malloc(newcap);
+    if (new != NULL)
+      memcpy(new, row->chars, cap);
+    // a running save still reads the old buffer, free it when it's done
+    if (row->shared) {
+      editorRetire(row->chars);
+      row->shared = 0;
+    }
+    row->borrowed = 0;
+  } else {
+    new = realloc(row->chars, newcap);
+  }
+  if (new == NULL)
+    die("realloc");
+  ssize_t tail = row->size - row->gap;
+  ssize_t newgaplen = newcap - row->size;
+  // text after the gap goes to the end of the new block
+  memmove(&new[row->gap + newgaplen], &new[row->gap + row->gaplen], tail);
+  row->chars = new;
+  row->gaplen = newgaplen;
+}
+
+/*
+  Return chars as one contiguous run of size bytes, without a terminator.
+  Unlike editorRowChars this never copies borrowed text, whose gap is
+  always at the end already.
+ */
+const char *editorRowText(erow *row) {
+  if (row->gap != row->size)
+    editorRowMoveGap(row, row->size);
+  return row->chars;
+}
+
+/*
+  Return chars as one contiguous, null terminated string by moving the gap
+  to the end of the row. Readers that can't deal with the gap use this.
+ */
+char *editorRowChars(erow *row) {
+  if (row->gaplen == 0 || row->borrowed)
+    editorRowReserve(row, 1);
+  editorRowMoveGap(row, row->size);
+  row->chars[row->size] = '\0';
+  return row->chars;
+}
+
+/*
+  Move cx and rx past the char at text[cx]. Returns the bytes it takes in
+  render: tabs become spaces and invalid UTF-8 becomes U+FFFD, one column
+  per bad byte.
+ */
+int editorRenderStep(const char *text, ssize_t len, ssize_t *cx, ssize_t *rx) {
+  unsigned char c = text[*cx];
+  if (c == '\t') {
+    int w = KILO_TAB_STOP - *rx % KILO_TAB_STOP;
+    *rx += w;
+    (*cx)++;
+    return w;
+  }
+  if (c < 0x80) {
+    (*rx)++;
+    (*cx)++;
+    return 1;
+  }
+  int cp;
+  int n = utf8Decode(text + *cx, len - *cx, &cp);
+  *cx += n;
+  if (cp < 0) {
+    (*rx)++;
+    return 3;
+  }
+  *rx += utf8Width(cp);
+  return n;
+}
+
+/* make room for n entries in row->cols */
+void editorColsReserve(erow *row, ssize_t n) {
+  if (row->cols && row->cols->cap >= n)
+    return;
+  ssize_t cap = row->cols ? row->cols->cap * 2 : 8;
+  while (cap < n)
+    cap *= 2;
+  colindex *ci = realloc(row->cols, sizeof(colindex) + sizeof(colchar) * cap);
+  if (ci == NULL)
+    die("realloc");
+  if (row->cols == NULL)
+    ci->n = 0;
+  ci->cap = cap;
+  row->cols = ci;
+}
+
+/* index the tabs and multibyte chars of row in one pass */
+void editorRowBuildCols(erow *row) {
+  if (row->cols)
+    row->cols->n = 0;
+  row->colstale = 0;
+  const char *text = editorRowText(row);
+  ssize_t cx = 0, rx = 0;
+  while (cx < row->size) {
+    const char *p = memchr(text + cx, '\t', row->size - cx);
+    ssize_t stop = p ? p - text : row->size;
+    // nothing to index up to the next tab on ASCII text, else char by char
+    if (utf8IsAscii(text + cx, stop - cx)) {
+      rx += stop - cx;
+      cx = stop;
+    }
+    while (cx < row->size && (cx < stop || text[cx] == '\t')) {
+      ssize_t from = cx, fromrx = rx;
+      editorRenderStep(text, row->size, &cx, &rx);
+      if (text[from] == '\t' || cx - from != rx - fromrx) {
+        editorColsReserve(row, (row->cols ? row->cols->n : 0) + 1);
+        row->cols->c[row->cols->n++] = (colchar){from, fromrx, cx - from, rx - fromrx};
+      }
+      if (text[from] == '\t')
+        break;
+    }
+  }
+  if (row->cols && row->cols->n == 0) {
+    free(row->cols);
+    row->cols = NULL;
+  }
+}
+
+/* index of the first entry of ci at or after cx */
+ssize_t editorColsFind(colindex *ci, ssize_t cx) {
+  ssize_t lo = 0, hi = ci->n;
+  while (lo < hi) {
+    ssize_t mid = (lo + hi) / 2;
+    if (ci->c[mid].cx < cx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+  Recompute columns from entry i on. Entries after the edit keep their
+  spacing, so once one of them comes out the same, so do all the rest.
+ */
+void editorColsFixRx(colindex *ci, ssize_t i) {
+  for (; i < ci->n; i++) {
+    colchar *e = &ci->c[i];
+    colchar *prev = i ? &ci->c[i - 1] : NULL;
+    ssize_t rx = prev ? prev->rx + prev->width + (e->cx - prev->cx - prev->len) : e->cx;
+    int width = e->len == 1 ? KILO_TAB_STOP - rx % KILO_TAB_STOP : e->width;
+    if (rx == e->rx && width == e->width)
+      break;
+    e->rx = rx;
+    e->width = width;
+  }
+}
+
+/*
+  Update cols for len ASCII bytes of s about to be inserted at at.
+  Anything else, like text that splits or makes up a multibyte char,
+  marks cols stale to be rebuilt when next needed.
+ */
+void editorColsInsert(erow *row, ssize_t at, const char *s, ssize_t len) {
+  if (row->colstale)
+    return;
+  if (!utf8IsAscii(s, len) || (at < row->size && (ROW_CHAR(row, at) & 0xc0) == 0x80)) {
+    row->colstale = 1;
+    return;
+  }
+  ssize_t tabs = 0;
+  for (ssize_t j = 0; j < len; j++)
+    if (s[j] == '\t') tabs++;
+  if (row->cols == NULL && tabs == 0)
+    return;
+  editorColsReserve(row, (row->cols ? row->cols->n : 0) + tabs);
+  colindex *ci = row->cols;
+  ssize_t i = editorColsFind(ci, at);
+  memmove(&ci->c[i + tabs], &ci->c[i], sizeof(colchar) * (ci->n - i));
+  ci->n += tabs;
+  for (ssize_t j = i + tabs; j < ci->n; j++)
+    ci->c[j].cx += len;
+  ssize_t k = i;
+  for (ssize_t j = 0; j < len; j++)
+    if (s[j] == '\t')
+      ci->c[k++] = (colchar){at + j, -1, 1, 0};
+  editorColsFixRx(ci, i);
+}
+
+/* update cols for the ASCII byte at at about to be deleted */
+void editorColsDelete(erow *row, ssize_t at) {
+  if (row->colstale || row->cols == NULL)
+    return;
+  char c = ROW_CHAR(row, at);
+  if ((c & 0x80) || (at + 1 < row->size && (ROW_CHAR(row, at + 1) & 0xc0) == 0x80)) {
+    row->colstale = 1;
+    return;
+  }
+  colindex *ci = row->cols;
+  ssize_t i = editorColsFind(ci, at);
+  if (c == '\t') {
+    memmove(&ci->c[i], &ci->c[i + 1], sizeof(colchar) * (ci->n - i - 1));
+    ci->n--;
+  }
+  for (ssize_t j = i; j < ci->n; j++)
+    ci->c[j].cx--;
+  editorColsFixRx(ci, i);
+}
+
+/* a control char, drawn as '?' so it can't reach the terminal */
+#define IS_CTRL(c) ((unsigned char)(c) < 0x20 || (c) == 0x7f)
+
+/*
+  1 if render would be a copy of chars: no tabs or control chars, valid
+  UTF-8, and the gap at the end so chars reads as one run.
+ */
+int editorRowIsPlain(erow *row, ssize_t tabs, ssize_t ctrl) {
+  if (tabs || ctrl || row->gap != row->size)
+    return 0;
+  if (row->ascii)
+    return 1;
+  for (ssize_t j = 0; j < row->size;) {
+    int cp;
+    j += utf8Decode(&row->chars[j], row->size - j, &cp);
+    if (cp < 0)
+      return 0;
+  }
+  return 1;
+}
+
 void editorUpdateRow(erow *row) {
-  // count total number of tabs
-  int tabs;
-  for (int i = 0; i < row->size; i++) {
-    if (row->chars[i] == '\t') tabs++;
+  // most rows are plain ASCII and take the byte per column path
+  row->ascii = utf8IsAscii(row->chars, row->gap) &&
+               utf8IsAscii(&row->chars[row->gap + row->gaplen], row->size - row->gap);
+  // count total number of tabs and control chars
+  ssize_t tabs = 0, ctrl = 0;
+  for (ssize_t i = 0; i < row->size; i++) {
+    char c = ROW_CHAR(row, i);
+    if (c == '\t') tabs++;
+    else if (IS_CTRL(c)) ctrl++;
+  }
+  if (!row->rshared)
+    free(row->render);
+  row->rstale = 0;
+  row->hlin = -1;
+  // most rows need no expansion, render is then chars itself
+  if (editorRowIsPlain(row, tabs, ctrl)) {
+    row->render = row->chars;
+    row->rsize = row->size;
+    row->rshared = 1;
+    return;
   }
-  free(row->render);
+  row->rshared = 0;
   /* reserve space for tabs as well. Each tab takes 8 char of space.
-     multplying with 7 because 1 space is already covered by size
+     multplying with 7 because 1 space is already covered by size.
+     A bad UTF-8 byte turns into 3 bytes of U+FFFD.
   */
-  row->render = malloc(row->size + (tabs * (KILO_TAB_STOP - 1)) + 1);
-
-  int j;
-  int idx = 0;
-  // copy each char into render
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
+  ssize_t cap = row->size * (row->ascii ? 1 : 3) + (tabs * (KILO_TAB_STOP - 1)) + 1;
+  row->render = malloc(cap);
+  if (row->render == NULL)
+    die("malloc");
+
+  ssize_t j;
+  ssize_t idx = 0;
+  if (row->ascii) {
+    // copy each char into render
+    for (j = 0; j < row->size; j++) {
+      char c = ROW_CHAR(row, j);
+      if (c == '\t') {
+        row->render[idx++] = ' ';
+        while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
+      } else {
+        row->render[idx++] = IS_CTRL(c) ? '?' : c;
+      }
+    }
+  } else {
+    const char *text = editorRowText(row);
+    ssize_t rx = 0;
+    for (j = 0; j < row->size;) {
+      ssize_t from = j;
+      int n = editorRenderStep(text, row->size, &j, &rx);
+      if (text[from] == '\t')
+        memset(&row->render[idx], ' ', n);
+      else if (j - from != n)
+        memcpy(&row->render[idx], "\xef\xbf\xbd", 3);
+      else if (IS_CTRL(text[from]))
+        row->render[idx] = '?';
+      else
+        memcpy(&row->render[idx], &text[from], n);
+      idx += n;
     }
   }
   row->render[idx] = '\0';
   row->rsize = idx;
 }
 
+/*
+  Bytes held by rows: the row array, their text wherever it lives and
+  render copies. *elided is what rows sharing chars as render would have
+  taken with a copy each. Allocator overhead is not counted.
+ */
+void editorRowMemory(long *rows, long *text, long *render, long *elided) {
+  *rows = (long)sizeof(erow) * E.rowcap;
+  *text = *render = *elided = 0;
+  for (ssize_t j = 0; j < E.numrows; j++) {
+    erow *row = &E.row[j];
+    *text += row->size + row->gaplen;
+    if (row->render == NULL)
+      continue;
+    if (row->rshared)
+      *elided += row->rsize + 1;
+    else
+      *render += row->rsize + 1;
+  }
+}
+
+/*
+  The text of row changed: its render is rebuilt before the next draw and
+  highlighting has to be redone from it on.
+ */
+void editorRowChanged(erow *row) {
+  row->rstale = 1;
+  ssize_t at = row - E.row;
+  if (at < E.hlvalid)
+    E.hlvalid = at;
+}
+
+/*
+  Make room for at least n rows. Capacity grows geometrically so appending
+  rows one by one costs amortized O(1) instead of a realloc per row.
+ */
+void editorReserveRows(ssize_t n) {
+  if (n <= E.rowcap)
+    return;
+  ssize_t newcap = E.rowcap ? E.rowcap * 2 : 64;
+  while (newcap < n)
+    newcap *= 2;
+  erow *new = realloc(E.row, sizeof(erow) * newcap);
+  if (new == NULL)
+    die("realloc");
+  E.row = new;
+  E.rowcap = newcap;
+}
+
+/*
+  Point a new row at text that lives elsewhere, in E.arena or E.map. It
+  is copied into a buffer of its own on the first edit.
+ */
+void editorBorrowRow(erow *row, char *s, size_t len) {
+  row->size = len;
+  row->chars = s;
+  row->gap = len;
+  row->gaplen = 0;
+  row->borrowed = 1;
+  row->shared = 0;
+
+  /* render and highlighting are built when the row is first drawn */
+  row->rsize = 0;
+  row->render = NULL;
+  row->rstale = 1;
+  row->rshared = 0;
+  row->ascii = 1;
+  row->cols = NULL;
+  row->colstale = 1;
+  row->hl = NULL;
+  row->hlin = -1;
+  row->hlstate = 0;
+}
+
+/* set up a new row holding a copy of s */
+void editorInitRow(erow *row, const char *s, size_t len) {
+  if (E.arena == NULL && (E.arena = createArena(ARENA_BLOCK_SIZE)) == NULL)
+    die("createArena");
+  /* text goes into the arena, the row gets its own buffer on first edit */
+  char *chars = arenaAlloc(E.arena, len);
+  if (chars == NULL)
+    die("arenaAlloc");
+  memcpy(chars, s, len);
+  editorBorrowRow(row, chars, len);
+}
+
+/* make room for n empty rows starting at row at */
+void editorInsertRows(ssize_t at, ssize_t n) {
+  // rows of a mapped file are found by index, they can't move
+  if (at < E.maprows)
+    editorMaterializeRows();
+  editorWrapRows(at, 0, n);
+  editorReserveRows(E.numrows + n);
+  memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+  for (ssize_t j = at; j < at + n; j++)
+    editorInitRow(&E.row[j], "", 0);
+  E.numrows += n;
+  if (at < E.hlvalid)
+    E.hlvalid = at;
+  E.dirty++;
+}
+
+void editorFreeRow(erow *row) {
+  if (!row->rshared)
+    free(row->render);
+  free(row->cols);
+  free(row->hl);
+  if (row->shared)
+    editorRetire(row->chars);
+  else if (!row->borrowed)
+    free(row->chars);
+}
+
+/* remove n rows starting at row at */
+void editorDelRows(ssize_t at, ssize_t n) {
+  if (at < E.maprows)
+    editorMaterializeRows();
+  editorWrapRows(at, n, 0);
+  for (ssize_t j = at; j < at + n; j++)
+    editorFreeRow(&E.row[j]);
+  memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numrows - at - n));
+  E.numrows -= n;
+  if (at < E.hlvalid)
+    E.hlvalid = at;
+  E.dirty++;
+}
+
 void editorAppendRow(char *s, size_t len) {
   // extend memory for all existing rows + 1 for a new line
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+  editorReserveRows(E.numrows + 1);
   // next line
-  int at = E.numrows;
-  E.row[at].size = len;
-  // allocate memory for actual data string
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
-
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  editorUpdateRow(&E.row[at]);
+  editorInitRow(&E.row[E.numrows], s, len);
   E.numrows++;
   E.dirty++;
 }
 
 
-void editorRowInsertChar(erow *row, int at, int c) {
+void editorRowInsertChar(erow *row, ssize_t at, int c) {
   if (at < 0 || at > row->size)
     at = row->size;
-  /* allocate space for new char and string terminator */
-  row->chars = realloc(row->chars, row->size + 2);
-  /*
-    Move data from at to new location which is at + 1.
-    if at is end of line then nothing will be moved but
-    if at is in the middle of the string then string to the right of at will be
-    moved. size of bytes will be string size - bytes to the left (which is at)
-    and + 1 for '\0'
-   */
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  char ch = c;
+  editorColsInsert(row, at, &ch, 1);
+  /* make room in the gap and move it where the char goes */
+  editorRowReserve(row, 1);
+  editorRowMoveGap(row, at);
+  row->chars[row->gap++] = c; // insert char
+  row->gaplen--;
   row->size++; // increment row size
-  row->chars[at] = c; // insert char
-  editorUpdateRow(row); // rerender row
+  // render is rebuilt once before the next draw instead of on every key
+  editorRowChanged(row);
+  E.dirty++;
+}
+
+/* insert len bytes of s at position at in one go */
+void editorRowInsertText(erow *row, ssize_t at, const char *s, ssize_t len) {
+  if (at < 0 || at > row->size)
+    at = row->size;
+  editorColsInsert(row, at, s, len);
+  editorRowReserve(row, len);
+  editorRowMoveGap(row, at);
+  memcpy(&row->chars[row->gap], s, len);
+  row->gap += len;
+  row->gaplen -= len;
+  row->size += len;
+  editorRowChanged(row);
   E.dirty++;
 }
 
 /*** editor operations ***/
 
+void editorJournal(int type, ssize_t y, ssize_t x, const char *s, ssize_t len, int newrow);
+void editorJournalChar(int type, ssize_t y, ssize_t x, char c, int newrow);
+ssize_t editorRowPrevChar(erow *row, ssize_t cx);
+
 void editorInsertChar(int c) {
+  editorJournalChar(UNDO_INSERT, E.cy, E.cx, c, E.cy == E.numrows);
   /* insert row if it doesn't exist yet */
   if (E.cy == E.numrows) {
     editorAppendRow("", 0);
   }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
+  editorRowInsertChar(editorRow(E.cy), E.cx, c);
   E.cx++; // move cursor to next position on x
 }
 
-void editorRowDelChar(erow *row, int at) {
+/*
+  Insert a block of text at the cursor, used for pastes. Lines may end in
+  \r, \n or \r\n. All new rows are created with one editorInsertRows call
+  and every affected row is rendered once, when it is next drawn.
+ */
+void editorInsertText(const char *s, ssize_t len) {
+  if (len == 0)
+    return;
+  editorJournal(UNDO_INSERT, E.cy, E.cx, s, len, E.cy == E.numrows);
+  if (E.cy == E.numrows) {
+    editorAppendRow("", 0);
+  }
+  // count the lines in s
+  ssize_t breaks = 0;
+  for (ssize_t i = 0; i < len; i++) {
+    if (s[i] == '\n' || (s[i] == '\r' && !(i + 1 < len && s[i + 1] == '\n')))
+      breaks++;
+  }
+  erow *row = editorRow(E.cy);
+  if (breaks == 0) {
+    editorRowInsertText(row, E.cx, s, len);
+    E.cx += len;
+    return;
+  }
+
+  /* cut the text after the cursor off the current row */
+  editorRowMoveGap(row, E.cx);
+  ssize_t taillen = row->size - E.cx;
+  char *tail = malloc(taillen ? taillen : 1);
+  if (tail == NULL)
+    die("malloc");
+  memcpy(tail, &row->chars[row->gap + row->gaplen], taillen);
+  row->gaplen += taillen;
+  row->size = E.cx;
+  row->colstale = 1;
+
+  editorInsertRows(E.cy + 1, breaks);
+  ssize_t y = E.cy;
+  const char *line = s;
+  for (ssize_t i = 0; i <= len; i++) {
+    if (i < len && s[i] != '\n' && s[i] != '\r')
+      continue;
+    ssize_t linelen = &s[i] - line;
+    if (y == E.cy) {
+      editorRowInsertText(editorRow(y), E.cx, line, linelen);
+    } else if (i < len) {
+      editorInitRow(&E.row[y], line, linelen);
+    } else {
+      // the last line gets the text that followed the cursor
+      erow *last = &E.row[y];
+      editorInitRow(last, line, linelen);
+      editorRowInsertText(last, linelen, tail, taillen);
+      E.cx = linelen;
+    }
+    if (i < len && s[i] == '\r' && i + 1 < len && s[i + 1] == '\n')
+      i++;
+    line = &s[i + 1];
+    y++;
+  }
+  free(tail);
+  E.cy += breaks;
+}
+
+void editorRowDelChar(erow *row, ssize_t at) {
   if (at < 0 || at >= row->size)
     return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+  editorColsDelete(row, at);
+  /* put the gap right after the char, then grow the gap over it */
+  editorRowMoveGap(row, at + 1);
+  row->gap--;
+  row->gaplen++;
   row->size--;
-  editorUpdateRow(row);
+  editorRowChanged(row);
   E.dirty++;
 }
 
 void editorDeleteChar() {
   if (E.cy == E.numrows)
     return;
-  erow *row = &E.row[E.cy];
+  erow *row = editorRow(E.cy);
   if (E.cx > 0) {
-    editorRowDelChar(row, E.cx - 1);
-    E.cx--;
+    // all bytes of a multibyte char, last one first
+    ssize_t start = editorRowPrevChar(row, E.cx);
+    while (E.cx > start) {
+      editorJournalChar(UNDO_DELETE, E.cy, E.cx - 1, ROW_CHAR(row, E.cx - 1), 0);
+      editorRowDelChar(row, E.cx - 1);
+      E.cx--;
+    }
   }
 }
 
-/*** file i/o ***/
-
-char *editorRowsToString(int *buflen) {
-  int totlen = 0;
-  int j;
-  /* calc total length of final string by adding len of each row + 1 for each new line*/
-  for (j = 0; j < E.numrows; j++) {
-    totlen += E.row[j].size + 1;
+/*
+  Delete len bytes of text starting at row y, column x, where the end of
+  a row counts as one byte. Rows in between are dropped with a single
+  move of the row array, so this is O(len) however many lines it spans.
+ */
+void editorDeleteText(ssize_t y, ssize_t x, ssize_t len) {
+  erow *row = editorRow(y);
+  ssize_t ey = y, ex = x + len;
+  while (ex > E.row[ey].size && ey + 1 < E.numrows) {
+    ex -= E.row[ey].size + 1;
+    ey++;
+    editorRow(ey);
   }
-  *buflen = totlen;
+  if (ey == y) {
+    // grow the gap back over the text
+    editorRowMoveGap(row, x + len);
+    row->gap -= len;
+    row->gaplen += len;
+    row->size -= len;
+    row->colstale = 1;
+    editorRowChanged(row);
+    E.dirty++;
+    return;
+  }
+  // cut row y at x and append what follows the text on row ey
+  editorRowMoveGap(row, x);
+  row->gaplen += row->size - x;
+  row->size = x;
+  row->colstale = 1;
+  erow *last = &E.row[ey];
+  editorRowInsertText(row, x, editorRowText(last) + ex, last->size - ex);
+  editorDelRows(y + 1, ey - y);
+}
+
+/*** undo ***/
+
+/* append a record, dropping the undone records after the current one */
+static undoOp *editorJournalAdd(int type, ssize_t y, ssize_t x, ssize_t len, int newrow) {
+  if (E.undolog == NULL && (E.undolog = createArena(KILO_UNDO_BLOCK)) == NULL)
+    die("createArena");
+  E.nundo = E.undopos;
+  if (E.nundo == E.undocap) {
+    E.undocap = E.undocap ? E.undocap * 2 : 256;
+    E.undo = realloc(E.undo, sizeof(undoOp) * E.undocap);
+    if (E.undo == NULL)
+      die("realloc");
+  }
+  undoOp *op = &E.undo[E.nundo++];
+  *op = (undoOp){type, y, x, len, newrow, NULL};
+  E.undopos = E.nundo;
+  if ((op->text = arenaAlloc(E.undolog, len ? len : 1)) == NULL)
+    die("arenaAlloc");
+  E.undobytes += len;
+  return op;
+}
+
+/* record inserting or deleting s at y, x. \r\n and \r are stored as \n */
+void editorJournal(int type, ssize_t y, ssize_t x, const char *s, ssize_t len, int newrow) {
+  if (E.replaying)
+    return;
+  undoOp *op = editorJournalAdd(type, y, x, len, newrow);
+  ssize_t n = 0;
+  for (ssize_t i = 0; i < len; i++) {
+    if (s[i] == '\r') {
+      op->text[n++] = '\n';
+      if (i + 1 < len && s[i + 1] == '\n')
+        i++;
+    } else {
+      op->text[n++] = s[i];
+    }
+  }
+  op->len = n;
+  E.undoopen = 0;
+}
+
+/*
+  Record one typed or deleted char. It joins the run in the last record
+  when it continues it, so typing costs a record per word, not per key.
+ */
+void editorJournalChar(int type, ssize_t y, ssize_t x, char c, int newrow) {
+  if (E.replaying)
+    return;
+  undoOp *op = E.undopos ? &E.undo[E.undopos - 1] : NULL;
+  int extend = 0, prepend = 0;
+  if (E.undoopen && E.undopos == E.nundo && op->type == type && op->y == y) {
+    if (type == UNDO_INSERT) {
+      // a new word starts a new record
+      unsigned char prev = op->text[op->len - 1];
+      extend = x == op->x + op->len &&
+               !(isspace(prev) && !isspace((unsigned char)c));
+    } else {
+      // backspace deletes in front of the run, delete after it
+      prepend = x == op->x - 1;
+      extend = prepend || x == op->x;
+    }
+  }
+  if (!extend) {
+    op = editorJournalAdd(type, y, x, 1, newrow);
+    op->text[0] = c;
+    E.undoopen = 1;
+    return;
+  }
+  if ((op->text = arenaGrow(E.undolog, op->text, op->len, 1)) == NULL)
+    die("arenaGrow");
+  if (prepend) {
+    memmove(op->text + 1, op->text, op->len);
+    op->text[0] = c;
+    op->x = x;
+  } else {
+    op->text[op->len] = c;
+  }
+  op->len++;
+  E.undobytes++;
+}
+
+/* put text back at y, x, appending row y first if it was appended */
+static void editorUndoInsert(undoOp *op) {
+  E.cy = op->y;
+  E.cx = op->x;
+  editorInsertText(op->text, op->len);
+}
+
+static void editorUndoDelete(undoOp *op) {
+  editorDeleteText(op->y, op->x, op->len);
+  if (op->newrow)
+    editorDelRows(op->y, 1);
+  E.cy = op->y;
+  E.cx = op->x;
+}
+
+/* Ctrl-Z: revert the last edit, one record at a time */
+void editorUndo() {
+  if (E.undopos == 0) {
+    editorSetStatusMessage("Nothing to undo");
+    return;
+  }
+  undoOp *op = &E.undo[--E.undopos];
+  E.replaying = 1;
+  if (op->type == UNDO_INSERT) {
+    editorUndoDelete(op);
+  } else {
+    editorUndoInsert(op);
+  }
+  E.replaying = 0;
+  E.undoopen = 0;
+}
+
+/* Ctrl-Y: apply the last undone edit again */
+void editorRedo() {
+  if (E.undopos == E.nundo) {
+    editorSetStatusMessage("Nothing to redo");
+    return;
+  }
+  undoOp *op = &E.undo[E.undopos++];
+  E.replaying = 1;
+  if (op->type == UNDO_INSERT) {
+    editorUndoInsert(op);
+  } else {
+    editorUndoDelete(op);
+  }
+  E.replaying = 0;
+  E.undoopen = 0;
+}
+
+/*** file i/o ***/
+
+char *editorRowsToString(ssize_t *buflen) {
+  ssize_t totlen = 0;
+  ssize_t j;
+  /* calc total length of final string by adding len of each row + 1 for each new line*/
+  for (j = 0; j < E.numrows; j++) {
+    totlen += editorRow(j)->size + 1;
+  }
+  *buflen = totlen;
   // allocate memory for buffer
   char *buf = malloc(totlen);
   // pointer to keep the location of next memory for copy
   // initially points at the start of buffer.
   char *p = buf;
   for (j = 0; j < E.numrows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size; // move the pointer by size of the row
+    erow *row = editorRow(j);
+    // copy text before and after the gap
+    memcpy(p, row->chars, row->gap);
+    memcpy(p + row->gap, &row->chars[row->gap + row->gaplen],
+           row->size - row->gap);
+    p += row->size; // move the pointer by size of the row
     *p = '\n';          // add new line
     p++; // increment pointer for new line
   }
@@ -372,128 +1578,1895 @@ char *editorRowsToString(int *buflen) {
 }
 
 
+/*
+  Fill in the rows of one block of a mapped file. The rows point straight
+  into the mapping; nothing is copied until a row is edited.
+ */
+void editorLoadBlock(ssize_t block) {
+  char *p = E.map + E.lineidx[block];
+  char *end = E.map + E.mapsize;
+  ssize_t first = block * KILO_LINE_BLOCK;
+  ssize_t last = first + KILO_LINE_BLOCK;
+  if (last > E.maprows)
+    last = E.maprows;
+  for (ssize_t at = first; at < last; at++) {
+    char *nl = memchr(p, '\n', end - p);
+    size_t len = (nl ? nl : end) - p;
+    // strip carriage returns like editorOpenRead does
+    while (len > 0 && p[len - 1] == '\r')
+      len--;
+    // rows kept over a reload are there already, see editorReload
+    if (E.row[at].chars == NULL)
+      editorBorrowRow(&E.row[at], p, len);
+    p = nl ? nl + 1 : end;
+  }
+  E.blockloaded[block] = 1;
+}
+
+/*
+  Worker pool for loading and whole file searches, one thread per core,
+  started the first time it is needed.
+ */
+ThreadPool *editorPool() {
+  if (E.pool == NULL) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    E.pool = createPool(n > 0 ? n : 1);
+    if (E.pool == NULL)
+      die("createPool");
+  }
+  return E.pool;
+}
+
+/* run tasks 0..ntasks-1 and wait for them, on the pool if there are several */
+void editorRunTasks(PoolTask fn, void *ctx, int ntasks) {
+  if (ntasks == 1) {
+    fn(ctx, 0);
+    return;
+  }
+  poolSubmit(editorPool(), fn, ctx, ntasks);
+  poolWait(E.pool, -1);
+}
+
+/*
+  A file being loaded is cut into chunks of KILO_LOAD_CHUNK bytes, one
+  pool task each. The first pass reads each chunk if it isn't mapped and
+  counts its line breaks, which gives every chunk the number of its first
+  row. The second pass then fills in rows or line index entries of all
+  chunks at once, each writing its own part of the arrays. The first pass
+  also hashes each KILO_HASH_BLOCK of the file when asked to, while the
+  bytes are still in cache.
+ */
+typedef struct loadChunk {
+  ssize_t breaks; // line breaks in the chunk
+  ssize_t first; // line breaks before the chunk
+} loadChunk;
+
+typedef struct loadJob {
+  int fd; // file to read text from, -1 if text is a mapping
+  char *text;
+  size_t size;
+  loadChunk *chunks;
+  ssize_t numrows;
+  int err; // errno of a failed read
+  ssize_t row0; // row the text starts at
+  hashBlock *hashes; // blocks of text are hashed into here unless it is NULL
+} loadJob;
+
+static void loadCountTask(void *ctx, int task) {
+  loadJob *job = ctx;
+  size_t lo = (size_t)task * KILO_LOAD_CHUNK;
+  size_t len = job->size - lo < KILO_LOAD_CHUNK ? job->size - lo : KILO_LOAD_CHUNK;
+  for (size_t got = 0; job->fd != -1 && got < len;) {
+    ssize_t n = pread(job->fd, job->text + lo + got, len - got, lo + got);
+    if (n <= 0) {
+      if (n == -1 && errno == EINTR)
+        continue;
+      // the file shrank since it was sized, or the read failed
+      job->err = n == 0 ? EIO : errno;
+      return;
+    }
+    got += n;
+  }
+  if (job->hashes == NULL) {
+    job->chunks[task].breaks = searchCount(job->text + lo, len, '\n');
+    return;
+  }
+  for (size_t off = 0; off < len; off += KILO_HASH_BLOCK) {
+    size_t n = len - off < KILO_HASH_BLOCK ? len - off : KILO_HASH_BLOCK;
+    job->chunks[task].breaks += searchCount(job->text + lo + off, n, '\n');
+    job->hashes[(lo + off) / KILO_HASH_BLOCK] =
+        (hashBlock){lo + off, hashBytes(job->text + lo + off, n)};
+  }
+}
+
+/*
+  Rows whose line starts in the chunk: those after each of its line
+  breaks, and the first row for the first chunk. Sets *p to the start of
+  the first of them and returns how many there are.
+ */
+static ssize_t loadChunkRows(loadJob *job, int task, ssize_t *first, char **p) {
+  loadChunk *c = &job->chunks[task];
+  size_t lo = (size_t)task * KILO_LOAD_CHUNK;
+  *first = c->first + (task > 0);
+  ssize_t n = c->first + c->breaks - *first + 1;
+  if (*first + n > job->numrows)
+    n = job->numrows - *first;
+  if (n <= 0)
+    return 0;
+  *p = job->text + lo;
+  if (task > 0)
+    *p = (char *)memchr(*p, '\n', job->size - lo) + 1;
+  return n;
+}
+
+static void loadRowsTask(void *ctx, int task) {
+  loadJob *job = ctx;
+  ssize_t at;
+  char *p;
+  ssize_t n = loadChunkRows(job, task, &at, &p);
+  char *end = job->text + job->size;
+  for (ssize_t last = at + n; at < last; at++) {
+    char *nl = memchr(p, '\n', end - p);
+    size_t len = (nl ? nl : end) - p;
+    // strip carriage returns, the break they end is dropped too
+    while (len > 0 && p[len - 1] == '\r')
+      len--;
+    editorBorrowRow(&E.row[job->row0 + at], p, len);
+    p = nl ? nl + 1 : end;
+  }
+}
+
+/* record the start of every KILO_LINE_BLOCK'th row of the chunk in E.lineidx, text is in E.map */
+static void loadIndexTask(void *ctx, int task) {
+  loadJob *job = ctx;
+  ssize_t at;
+  char *p;
+  ssize_t n = loadChunkRows(job, task, &at, &p);
+  if (n == 0)
+    return;
+  at += job->row0;
+  ssize_t last = at + n;
+  ssize_t skip = (KILO_LINE_BLOCK - at % KILO_LINE_BLOCK) % KILO_LINE_BLOCK;
+  char *end = job->text + job->size;
+  // whole blocks of line breaks are skipped by counting, not line by line
+  for (at += skip; at < last; at += KILO_LINE_BLOCK) {
+    if (skip > 0)
+      p = (char *)searchNth(p, end - p, '\n', skip - 1) + 1;
+    E.lineidx[at / KILO_LINE_BLOCK] = p - E.map;
+    skip = KILO_LINE_BLOCK;
+  }
+}
+
+/* count the rows of text, reading it from fd first unless fd is -1 */
+static void loadCount(loadJob *job) {
+  int ntasks = job->size ? (job->size - 1) / KILO_LOAD_CHUNK + 1 : 0;
+  job->chunks = calloc(ntasks ? ntasks : 1, sizeof(loadChunk));
+  if (job->chunks == NULL)
+    die("calloc");
+  if (ntasks)
+    editorRunTasks(loadCountTask, job, ntasks);
+  if (job->err) {
+    errno = job->err;
+    die("read");
+  }
+  ssize_t breaks = 0;
+  for (int i = 0; i < ntasks; i++) {
+    job->chunks[i].first = breaks;
+    breaks += job->chunks[i].breaks;
+  }
+  // a last line without a line break is a row too
+  job->numrows = breaks + (job->size > 0 && job->text[job->size - 1] != '\n');
+}
+
+/* make room for n block hashes in E.hashes */
+void editorReserveHashes(ssize_t n) {
+  if (n <= E.hashcap)
+    return;
+  ssize_t newcap = E.hashcap ? E.hashcap * 2 : 16;
+  while (newcap < n)
+    newcap *= 2;
+  hashBlock *new = realloc(E.hashes, sizeof(hashBlock) * newcap);
+  if (new == NULL)
+    die("realloc");
+  E.hashes = new;
+  E.hashcap = newcap;
+}
+
+/* blocks a file of size bytes is hashed in when it is read whole */
+ssize_t editorHashCount(size_t size) {
+  return (size + KILO_HASH_BLOCK - 1) / KILO_HASH_BLOCK;
+}
+
+static void loadRun(loadJob *job, PoolTask fn) {
+  int ntasks = job->size ? (job->size - 1) / KILO_LOAD_CHUNK + 1 : 0;
+  if (ntasks)
+    editorRunTasks(fn, job, ntasks);
+  free(job->chunks);
+}
+
+/*
+  The line index and block hashes of a mapped file are kept next to it in
+  .<name>.kidx, so opening it again only maps it instead of reading all
+  of it. They are used while the file keeps the size, mtime and inode
+  they were made for. Writing them is best effort, a directory we can't
+  write to just means the file is read through again next time.
+ */
+#define KILO_INDEX_MAGIC "kiloidx1"
+
+typedef struct indexHeader {
+  char magic[8];
+  int64_t size;
+  int64_t mtime, mtimensec;
+  int64_t ino, dev;
+  int64_t lineblock, hashblock; // KILO_LINE_BLOCK and KILO_HASH_BLOCK it was made with
+  int64_t numrows;
+  int64_t nidx; // E.lineidx entries that follow the header, then the E.hashes
+  int64_t nhashes;
+} indexHeader;
+
+/* .<name>.kidx in the directory of filename */
+char *editorIndexPath(const char *filename) {
+  const char *slash = strrchr(filename, '/');
+  int dirlen = slash ? slash + 1 - filename : 0;
+  size_t len = strlen(filename) + 7;
+  char *path = malloc(len);
+  if (path == NULL)
+    die("malloc");
+  snprintf(path, len, "%.*s.%s.kidx", dirlen, filename, filename + dirlen);
+  return path;
+}
+
+static indexHeader editorIndexHeader(struct stat *st, ssize_t numrows) {
+  indexHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, KILO_INDEX_MAGIC, sizeof(h.magic));
+  h.size = st->st_size;
+  h.mtime = st->st_mtim.tv_sec;
+  h.mtimensec = st->st_mtim.tv_nsec;
+  h.ino = st->st_ino;
+  h.dev = st->st_dev;
+  h.lineblock = KILO_LINE_BLOCK;
+  h.hashblock = KILO_HASH_BLOCK;
+  h.numrows = numrows;
+  h.nidx = (numrows + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK;
+  h.nhashes = editorHashCount(st->st_size);
+  return h;
+}
+
+/* read len bytes at off, returns 0 if there aren't that many */
+static int preadAll(int fd, void *buf, size_t len, off_t off) {
+  for (size_t got = 0; got < len;) {
+    ssize_t n = pread(fd, (char *)buf + got, len - got, off + got);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    got += n;
+  }
+  return 1;
+}
+
+/*
+  Fill in E.lineidx and E.hashes for the file st from its saved index.
+  Returns the number of rows, or -1 if there is no index that fits.
+ */
+ssize_t editorIndexLoad(struct stat *st) {
+  char *path = editorIndexPath(E.filename);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1)
+    return -1;
+  indexHeader h;
+  ssize_t numrows = -1;
+  if (!preadAll(fd, &h, sizeof(h), 0) || h.numrows < 0)
+    goto done;
+  indexHeader want = editorIndexHeader(st, h.numrows);
+  if (memcmp(&h, &want, sizeof(h)) != 0)
+    goto done;
+  size_t *lineidx = malloc(sizeof(size_t) * (h.nidx ? h.nidx : 1));
+  if (lineidx == NULL)
+    die("malloc");
+  editorReserveHashes(h.nhashes);
+  off_t off = sizeof(h);
+  if (!preadAll(fd, lineidx, sizeof(size_t) * h.nidx, off) ||
+      !preadAll(fd, E.hashes, sizeof(hashBlock) * h.nhashes, off + sizeof(size_t) * h.nidx)) {
+    free(lineidx);
+    goto done;
+  }
+  // rows are found by these offsets, they have to stay inside the mapping
+  for (int64_t i = 0; i < h.nidx; i++) {
+    if (lineidx[i] >= (size_t)h.size || (i > 0 && lineidx[i] <= lineidx[i - 1])) {
+      free(lineidx);
+      goto done;
+    }
+  }
+  E.lineidx = lineidx;
+  E.nhashes = h.nhashes;
+  numrows = h.numrows;
+done:
+  close(fd);
+  return numrows;
+}
+
+/* save the index of the mapped file st while rows are still found by it, see editorIndexLoad */
+void editorIndexSave(struct stat *st) {
+  if (E.map == NULL || E.mapstale || E.maprows != E.numrows || (size_t)st->st_size != E.mapsize)
+    return;
+  char *path = editorIndexPath(E.filename);
+  size_t len = strlen(path) + 16;
+  char *tmpname = malloc(len);
+  if (tmpname == NULL)
+    die("malloc");
+  snprintf(tmpname, len, "%s.kiloXXXXXX", path);
+  int fd = mkstemp(tmpname);
+  if (fd != -1) {
+    indexHeader h = editorIndexHeader(st, E.numrows);
+    struct iovec iov[3] = {{&h, sizeof(h)},
+                           {E.lineidx, sizeof(size_t) * h.nidx},
+                           {E.hashes, sizeof(hashBlock) * h.nhashes}};
+    ssize_t want = sizeof(h) + iov[1].iov_len + iov[2].iov_len;
+    int ok = writevAll(fd, iov, 3) == want;
+    if (close(fd) == -1 || !ok || rename(tmpname, path) == -1)
+      unlink(tmpname);
+  }
+  free(tmpname);
+  free(path);
+}
+
+/*
+  Open a large file read-mostly: map it and record where every
+  KILO_LINE_BLOCK'th line starts, or take that from its saved index.
+  Rows are only built when they are drawn, searched or edited, so memory
+  stays small whatever the file size.
+ */
+void editorOpenMapped(int fd, struct stat *st) {
+  size_t size = st->st_size;
+  E.map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (E.map == MAP_FAILED) die("mmap");
+  E.mapsize = size;
+
+  ssize_t lines = editorIndexLoad(st);
+  int scanned = lines == -1;
+  if (scanned) {
+    madvise(E.map, size, MADV_SEQUENTIAL);
+    editorReserveHashes(editorHashCount(size));
+    E.nhashes = editorHashCount(size);
+    loadJob job = {-1, E.map, size, NULL, 0, 0, 0, E.hashes};
+    loadCount(&job);
+    lines = job.numrows;
+    ssize_t nidx = (lines + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK;
+    E.lineidx = malloc(sizeof(size_t) * (nidx ? nidx : 1));
+    if (!E.lineidx) die("malloc");
+    loadRun(&job, loadIndexTask);
+    // the scan only needs each page once, drop them from our resident set
+    madvise(E.map, size, MADV_DONTNEED);
+  }
+  madvise(E.map, size, MADV_RANDOM);
+  ssize_t nidx = (lines + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK;
+
+  /*
+    calloc of a large array is backed by untouched zero pages, so rows
+    that are never materialized don't cost resident memory.
+   */
+  E.row = calloc(lines ? lines : 1, sizeof(erow));
+  E.blockloaded = calloc(nidx ? nidx : 1, 1);
+  if (!E.row || !E.blockloaded) die("calloc");
+  E.rowcap = lines;
+  E.numrows = lines;
+  E.maprows = lines;
+  if (scanned)
+    editorIndexSave(st);
+}
+
+/*
+  Read a file into one arena allocation and point every row into it, the
+  rows are filled in by the pool a chunk at a time.
+ */
+void editorOpenRead(int fd, size_t size) {
+  if (E.arena == NULL && (E.arena = createArena(ARENA_BLOCK_SIZE)) == NULL)
+    die("createArena");
+  char *text = arenaAlloc(E.arena, size);
+  if (text == NULL)
+    die("arenaAlloc");
+  editorReserveHashes(editorHashCount(size));
+  E.nhashes = editorHashCount(size);
+  loadJob job = {fd, text, size, NULL, 0, 0, 0, E.hashes};
+  loadCount(&job);
+  editorReserveRows(job.numrows);
+  E.numrows = job.numrows;
+  loadRun(&job, loadRowsTask);
+}
+
+/*
+  Materialize every row of a mapped file and stop loading rows by index,
+  needed before rows are inserted and the indexes shift. Rows keep
+  pointing into the mapping.
+ */
+void editorMaterializeRows() {
+  for (ssize_t b = 0; b * KILO_LINE_BLOCK < E.maprows; b++) {
+    if (!E.blockloaded[b])
+      editorLoadBlock(b);
+  }
+  E.maprows = 0;
+}
+
 void editorOpen(char *filename) {
   free(E.filename);
   E.filename = strdup(filename);
+  E.syntax = syntaxForFile(filename);
   // open given file
   FILE *fp = fopen(filename, "r");
   if (!fp) die("fopen");
 
+  struct stat st;
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+    if (st.st_size >= KILO_LAZY_THRESHOLD)
+      editorOpenMapped(fileno(fp), &st);
+    else
+      editorOpenRead(fileno(fp), st.st_size);
+    fclose(fp);
+    E.filesize = st.st_size;
+    E.filestat = st;
+    E.dirty = 0;
+    editorWatch();
+    return;
+  }
+
+  // a pipe or device can't be sized up front, read it a line at a time
   char *line = NULL;
   size_t linecap = 0;
   ssize_t linelen;
-  // read each line. getline which can also manage memory so you don't need to
-  // worry about allocation
-  // reuse line pointer for new line.
   while ((linelen = getline(&line, &linecap, fp)) != -1) {
     // strip new line and carriage return from each line end.
     while (linelen > 0 &&
            (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
       linelen--;
     }
-    editorAppendRow(line, linelen);
+    editorAppendRow(line, linelen);
+  }
+  free(line);
+  fclose(fp);
+  E.dirty = 0;
+}
+
+/*** file changes ***/
+
+/*
+  The open file is looked at for changes made by other programs: appends
+  while following it, anything else otherwise, see editorChangeCheck.
+  Linux wakes the editor with inotify, elsewhere the file is looked at
+  every KILO_FOLLOW_POLL ms while following and every KILO_CHANGE_POLL ms
+  otherwise.
+ */
+
+/* ms until the file is looked at again, <= 0 if it is due */
+int editorFileWait() {
+  int poll = E.follow || E.watchfd != -1 ? KILO_FOLLOW_POLL : KILO_CHANGE_POLL;
+  return poll - (int)((histNow() - E.filetime) / 1000000);
+}
+
+/* watch the file by name, again after a save or reload replaced it */
+void editorWatch() {
+  if (E.watchfd != -1)
+    close(E.watchfd);
+  E.watchfd = -1;
+#ifdef __linux__
+  E.watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF;
+  if (E.watchfd != -1 && inotify_add_watch(E.watchfd, E.filename, mask) == -1) {
+    close(E.watchfd);
+    E.watchfd = -1;
+  }
+#endif
+}
+
+/* a and b are the same version of the same file */
+int editorSameFile(struct stat *a, struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+  Hash what was appended to fd after the file grew from E.filesize to size
+  bytes: the last block grows to KILO_HASH_BLOCK bytes, new ones follow.
+ */
+void editorRehash(int fd, size_t size) {
+  size_t off = E.filesize;
+  if (E.nhashes > 0 && off - E.hashes[E.nhashes - 1].off < KILO_HASH_BLOCK)
+    off = E.hashes[--E.nhashes].off;
+  char *buf = malloc(KILO_HASH_BLOCK);
+  if (buf == NULL)
+    die("malloc");
+  for (; off < size; off += KILO_HASH_BLOCK) {
+    size_t len = size - off < KILO_HASH_BLOCK ? size - off : KILO_HASH_BLOCK;
+    ssize_t n;
+    while ((n = pread(fd, buf, len, off)) == -1 && errno == EINTR)
+      ;
+    // a block that can't be read won't match the file, which only costs a bigger reload
+    editorReserveHashes(E.nhashes + 1);
+    E.hashes[E.nhashes++] = (hashBlock){off, hashBytes(buf, n > 0 ? n : 0)};
+  }
+  free(buf);
+}
+
+/*** follow ***/
+
+/*
+  Follow mode, like tail -f: bytes written to the end of the file are
+  appended as rows while they arrive. The open file is followed, so one
+  that is renamed away keeps being followed.
+ */
+
+void editorFollowClose() {
+  if (E.followfd != -1)
+    close(E.followfd);
+  E.followfd = -1;
+  E.follow = 0;
+}
+
+/* follow the file from offset on, the rows hold everything before it */
+void editorFollowOpen(ssize_t offset) {
+  editorFollowClose();
+  E.followfd = open(E.filename, O_RDONLY);
+  if (E.followfd == -1) {
+    editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+    return;
+  }
+  char last;
+  E.followpartial = offset > 0 && pread(E.followfd, &last, 1, offset - 1) == 1 && last != '\n';
+  E.filesize = offset;
+  E.follow = 1;
+  // pick up whatever was written since the rows were read
+  E.fileready = 1;
+}
+
+/* ^T or --follow: start or stop following the file */
+void editorSetFollow(int on) {
+  if (!on) {
+    editorFollowClose();
+    editorSetStatusMessage("Stopped following");
+    E.fileready = 1;
+    return;
+  }
+  if (E.filename == NULL || E.filesize < 0) {
+    editorSetStatusMessage("Only a regular file can be followed");
+    return;
+  }
+  editorFollowOpen(E.filesize);
+  if (E.follow)
+    editorSetStatusMessage("Following %s, ^T to stop", E.filename);
+}
+
+/*
+  Turn len bytes read from the end of the file into rows, the same way
+  editorOpenRead does. They are the file's own text, so the buffer isn't
+  marked modified.
+ */
+void editorFollowAppend(char *text, size_t len) {
+  int dirty = E.dirty;
+  if (E.followpartial && E.numrows > 0) {
+    char *nl = memchr(text, '\n', len);
+    size_t n = (nl ? nl : text + len) - text;
+    erow *row = editorRow(E.numrows - 1);
+    editorRowInsertText(row, row->size, text, n);
+    // strip carriage returns once the line is complete
+    while (nl && row->size > 0 && ROW_CHAR(row, row->size - 1) == '\r')
+      editorRowDelChar(row, row->size - 1);
+    n += nl != NULL;
+    text += n;
+    len -= n;
+  }
+  if (len > 0) {
+    loadJob job = {-1, text, len, NULL, 0, 0, E.numrows, NULL};
+    loadCount(&job);
+    editorReserveRows(E.numrows + job.numrows);
+    E.numrows += job.numrows;
+    loadRun(&job, loadRowsTask);
+    E.followpartial = text[len - 1] != '\n';
+  }
+  E.dirty = dirty;
+}
+
+/*
+  Called from the main loop: append what was written to a followed file
+  since it was last looked at, up to KILO_FOLLOW_MAX bytes at a time so a
+  burst still lets the screen be redrawn. A cursor on the last row stays
+  on the last row.
+ */
+void editorFollowCheck() {
+  // a headless editor looks at every step, there is nothing to wait on
+  if (!E.follow || (!E.fileready && !E.term))
+    return;
+  E.fileready = 0;
+  E.filetime = histNow();
+  struct stat st;
+  if (fstat(E.followfd, &st) == -1)
+    return;
+  if (st.st_size < E.filesize) {
+    editorSetStatusMessage("%s was truncated, following from its new end", E.filename);
+    E.filesize = st.st_size;
+    E.followpartial = 0;
+    return;
+  }
+  ssize_t len = st.st_size - E.filesize;
+  if (len == 0)
+    return;
+  if (len > KILO_FOLLOW_MAX) {
+    len = KILO_FOLLOW_MAX;
+    E.fileready = 1;
+  }
+  if (E.arena == NULL && (E.arena = createArena(ARENA_BLOCK_SIZE)) == NULL)
+    die("createArena");
+  char *text = arenaAlloc(E.arena, len);
+  if (text == NULL)
+    die("arenaAlloc");
+  ssize_t got = 0;
+  while (got < len) {
+    ssize_t n = pread(E.followfd, text + got, len - got, E.filesize + got);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  int atend = E.cy >= E.numrows - 1;
+  ssize_t oldrows = E.numrows;
+  editorFollowAppend(text, got);
+  editorRehash(E.followfd, E.filesize + got);
+  E.filesize += got;
+  // the file as far as it was read, a reload picks up the rest after following stops
+  E.filestat = st;
+  E.filestat.st_size = E.filesize;
+  if (atend && E.numrows > oldrows) {
+    E.cy = E.numrows - 1;
+    E.cx = 0;
+  }
+}
+
+/*** reload ***/
+
+/*
+  Another program changed the file. A clean buffer is reloaded in place:
+  the blocks of E.hashes are looked for in the new file, from the start at
+  the same offsets and from the end moved by the change in size, which
+  reads every unchanged byte once and counts its line breaks on the way.
+  Only the rows between the first and the last changed block are parsed
+  again. The rows before and after keep their text, highlighting and the
+  cursor, and a mapped file keeps building rows on demand. With unsaved
+  edits nothing is reloaded, the next save asks before it overwrites the
+  other program's changes.
+ */
+#define RELOAD_TASK_BLOCKS (KILO_LOAD_CHUNK / KILO_HASH_BLOCK)
+
+/* a batch of blocks looked for in the new file, RELOAD_TASK_BLOCKS per task */
+typedef struct reloadJob {
+  const char *text; // the new file
+  size_t size;
+  int back; // blocks are looked for from the end, moved by shift
+  ssize_t shift;
+  size_t limit; // where the unchanged start of the file ends
+  ssize_t lo, hi; // blocks of the batch
+  char *same; // per block: found unchanged
+  ssize_t *breaks; // per block found: its line breaks
+} reloadJob;
+
+/* end of block i of E.hashes */
+static size_t reloadBlockEnd(ssize_t i) {
+  return i + 1 < E.nhashes ? E.hashes[i + 1].off : (size_t)E.filesize;
+}
+
+/* look for the task's blocks in the direction of the pass, up to the first that changed */
+static void reloadFindTask(void *ctx, int task) {
+  reloadJob *job = ctx;
+  ssize_t i = job->back ? job->hi - 1 - (ssize_t)task * RELOAD_TASK_BLOCKS
+                        : job->lo + (ssize_t)task * RELOAD_TASK_BLOCKS;
+  for (int k = 0; k < RELOAD_TASK_BLOCKS && i >= job->lo && i < job->hi; k++) {
+    ssize_t at = E.hashes[i].off + job->shift;
+    size_t len = reloadBlockEnd(i) - E.hashes[i].off;
+    if (at < (ssize_t)job->limit || at + len > job->size ||
+        hashBytes(job->text + at, len) != E.hashes[i].hash)
+      return;
+    job->same[i] = 1;
+    job->breaks[i] = searchCount(job->text + at, len, '\n');
+    i += job->back ? -1 : 1;
+  }
+}
+
+/* look for blocks [lo, hi) a batch at a time, returns how many in a row were found */
+static ssize_t reloadFind(reloadJob *job, ssize_t lo, ssize_t hi) {
+  ssize_t batch = (ssize_t)editorPool()->nthreads * RELOAD_TASK_BLOCKS;
+  ssize_t found = 0;
+  while (found < hi - lo) {
+    job->lo = job->back ? hi - found - batch : lo + found;
+    job->hi = job->back ? hi - found : lo + found + batch;
+    if (job->lo < lo)
+      job->lo = lo;
+    if (job->hi > hi)
+      job->hi = hi;
+    ssize_t n = job->hi - job->lo;
+    editorRunTasks(reloadFindTask, job, (n - 1) / RELOAD_TASK_BLOCKS + 1);
+    ssize_t k = 0;
+    while (k < n && job->same[job->back ? job->hi - 1 - k : job->lo + k])
+      k++;
+    found += k;
+    if (k < n)
+      break;
+  }
+  return found;
+}
+
+/* hashes of the changed bytes of the new file, in blocks from off on */
+typedef struct reloadHashJob {
+  const char *text;
+  size_t off, end;
+  hashBlock *hashes;
+} reloadHashJob;
+
+static void reloadHashTask(void *ctx, int task) {
+  reloadHashJob *job = ctx;
+  for (int k = 0; k < RELOAD_TASK_BLOCKS; k++) {
+    size_t i = (size_t)task * RELOAD_TASK_BLOCKS + k;
+    size_t at = job->off + i * KILO_HASH_BLOCK;
+    if (at >= job->end)
+      return;
+    size_t len = job->end - at < KILO_HASH_BLOCK ? job->end - at : KILO_HASH_BLOCK;
+    job->hashes[i] = (hashBlock){at, hashBytes(job->text + at, len)};
+  }
+}
+
+/*
+  Line index entries of the rows after the changed ones: each is found
+  from the nearest old entry after the change, moved by the change in
+  size, a few lines forward or back. Entries with none near start from
+  the first of those rows.
+ */
+typedef struct reloadIndexJob {
+  size_t *oldidx;
+  ssize_t first; // first entry to fill in
+  ssize_t last;
+  ssize_t row; // first row after the changed ones, at offset off
+  size_t off;
+  ssize_t rowdelta; // rows added by the change
+  ssize_t oldrow; // first row after the changed ones in the old file
+  ssize_t oldmaprows; // rows the old entries are for
+  ssize_t delta; // bytes added by the change
+} reloadIndexJob;
+
+#define RELOAD_INDEX_TASK 4096 // line index entries per task
+
+static void reloadIndexTask(void *ctx, int task) {
+  reloadIndexJob *job = ctx;
+  ssize_t b = job->first + (ssize_t)task * RELOAD_INDEX_TASK;
+  ssize_t last = b + RELOAD_INDEX_TASK < job->last ? b + RELOAD_INDEX_TASK : job->last;
+  const char *end = E.map + E.mapsize;
+  for (; b < last; b++) {
+    // the row of entry b was row old, between old entries k and k + 1
+    ssize_t old = b * KILO_LINE_BLOCK - job->rowdelta;
+    ssize_t k = old / KILO_LINE_BLOCK;
+    ssize_t ahead = old - k * KILO_LINE_BLOCK;
+    ssize_t behind = KILO_LINE_BLOCK - ahead;
+    int before = k * KILO_LINE_BLOCK >= job->oldrow && k * KILO_LINE_BLOCK < job->oldmaprows;
+    int after = (k + 1) * KILO_LINE_BLOCK < job->oldmaprows;
+    const char *p;
+    if (after && (!before || behind < ahead)) {
+      p = E.map + job->oldidx[k + 1] + job->delta;
+      for (ssize_t i = 0; i < behind; i++) {
+        const char *nl = memrchr(E.map, '\n', p - 1 - E.map);
+        p = nl ? nl + 1 : E.map;
+      }
+    } else {
+      ssize_t skip = ahead;
+      p = E.map + job->oldidx[k] + job->delta;
+      if (!before) {
+        skip = b * KILO_LINE_BLOCK - job->row;
+        p = E.map + job->off;
+      }
+      if (skip > 0)
+        p = searchNth(p, end - p, '\n', skip - 1) + 1;
+    }
+    E.lineidx[b] = p - E.map;
+  }
+}
+
+/* point a kept row that borrows from the old mapping at the same text in the new one */
+static void reloadRebase(erow *row, char *oldmap, size_t oldsize, char *map, ssize_t shift) {
+  if (!row->borrowed || row->chars < oldmap || row->chars > oldmap + oldsize)
+    return;
+  char *chars = map + (row->chars - oldmap) + shift;
+  if (row->rshared)
+    row->render = chars;
+  row->chars = chars;
+}
+
+/*
+  Find the bytes of the file that changed since it was read and replace
+  the rows holding them, st is the file as it is now. Returns 0 if the
+  file can't be read.
+ */
+int editorReload(struct stat *st) {
+  uint64_t start = histNow();
+  int fd = open(E.filename, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  size_t size = st->st_size;
+  char *text = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if (text == MAP_FAILED)
+    return 0;
+  madvise(text, size, MADV_WILLNEED);
+
+  // the unchanged blocks at the start, then at the end
+  ssize_t n = E.nhashes;
+  size_t oldsize = E.filesize;
+  ssize_t delta = size - oldsize;
+  char *same = calloc(n ? n : 1, 1);
+  ssize_t *breaks = malloc(sizeof(ssize_t) * (n ? n : 1));
+  if (!same || !breaks)
+    die("malloc");
+  reloadJob job = {text, size, 0, 0, 0, 0, 0, same, breaks};
+  ssize_t p = reloadFind(&job, 0, n);
+  size_t first = p < n ? E.hashes[p].off : oldsize;
+  if (p == n && delta == 0) {
+    // touched, or written back the same
+    free(same);
+    free(breaks);
+    if (text)
+      munmap(text, size);
+    E.filestat = *st;
+    editorIndexSave(st);
+    return 1;
+  }
+  memset(same + p, 0, n - p);
+  job = (reloadJob){text, size, 1, delta, first, 0, 0, same, breaks};
+  ssize_t s = n - reloadFind(&job, p, n);
+  size_t oldend = s < n ? E.hashes[s].off : oldsize;
+  size_t newend = oldend + delta;
+  ssize_t headbreaks = 0, tailbreaks = 0;
+  for (ssize_t i = 0; i < p; i++)
+    headbreaks += breaks[i];
+  for (ssize_t i = s; i < n; i++)
+    tailbreaks += breaks[i];
+  free(same);
+  free(breaks);
+
+  /*
+    The changed rows run from the start of the line holding the first
+    changed byte to the end of the line holding the last one. ra rows
+    before and rs rows after them are the same in both files.
+   */
+  char *nl = first ? memrchr(text, '\n', first) : NULL;
+  size_t a = nl ? (size_t)(nl + 1 - text) : 0;
+  nl = newend < size ? memchr(text + newend, '\n', size - newend) : NULL;
+  size_t x = nl ? (size_t)(nl + 1 - text) : size;
+  ssize_t ra = headbreaks;
+  ssize_t rs = x < size ? tailbreaks - 1 + (text[size - 1] != '\n') : 0;
+  loadJob mid = {-1, text + a, x - a, NULL, 0, 0, ra, NULL};
+  loadCount(&mid);
+  ssize_t oldmid = E.numrows - ra - rs;
+  ssize_t newmid = mid.numrows;
+  if (oldmid < 0) {
+    // the rows don't hold the file the hashes are of, take all of it
+    free(mid.chunks);
+    p = first = a = ra = 0;
+    s = n;
+    newend = x = size;
+    rs = 0;
+    mid = (loadJob){-1, text, size, NULL, 0, 0, 0, NULL};
+    loadCount(&mid);
+    oldmid = E.numrows;
+    newmid = mid.numrows;
+  }
+
+  // the new file's blocks: the unchanged ones, moved, around the changed bytes
+  ssize_t nmid = editorHashCount(newend - first);
+  hashBlock *hashes = malloc(sizeof(hashBlock) * (p + nmid + n - s + 1));
+  if (hashes == NULL)
+    die("malloc");
+  memcpy(hashes, E.hashes, sizeof(hashBlock) * p);
+  reloadHashJob hj = {text, first, newend, hashes + p};
+  if (nmid > 0)
+    editorRunTasks(reloadHashTask, &hj, (nmid - 1) / RELOAD_TASK_BLOCKS + 1);
+  for (ssize_t i = s; i < n; i++)
+    hashes[p + nmid + i - s] = (hashBlock){E.hashes[i].off + delta, E.hashes[i].hash};
+
+  /*
+    A mapped file that is still the one on disk moves to the new mapping,
+    what the old one shows may be rewritten under it. Rows keep being
+    built on demand if they were, the changed ones are parsed now.
+   */
+  int remap = E.map != NULL && !E.mapstale;
+  int lazy = remap && E.maprows > 0;
+  if (E.maprows > 0 && !lazy)
+    editorMaterializeRows();
+  char *oldmap = E.map;
+  size_t oldmapsize = E.mapsize;
+  ssize_t oldmaprows = E.maprows;
+  ssize_t oldrows = E.numrows;
+  for (ssize_t j = ra; j < ra + oldmid; j++)
+    editorFreeRow(&E.row[j]);
+  editorReserveRows(ra + newmid + rs);
+  memmove(&E.row[ra + newmid], &E.row[ra + oldmid], sizeof(erow) * rs);
+  editorWrapRows(ra, oldmid, newmid);
+  if (lazy)
+    memset(&E.row[ra], 0, sizeof(erow) * newmid);
+  E.numrows = ra + newmid + rs;
+
+  /*
+    Kept rows that borrow from the old mapping move to the new one. Of a
+    lazily built file only rows of loaded blocks and appended rows can be
+    materialized, their new blocks are loaded again below so that stays so.
+   */
+  ssize_t nidx = (E.numrows + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK;
+  char *keep = lazy ? calloc(nidx ? nidx : 1, 1) : NULL;
+  if (lazy && keep == NULL)
+    die("calloc");
+  for (ssize_t j = 0; remap && j < oldrows; j++) {
+    if (lazy && j < oldmaprows && !E.blockloaded[j / KILO_LINE_BLOCK]) {
+      j += KILO_LINE_BLOCK - 1;
+      continue;
+    }
+    if (j >= ra && j < ra + oldmid)
+      continue;
+    ssize_t at = j < ra ? j : j + newmid - oldmid;
+    reloadRebase(&E.row[at], oldmap, oldmapsize, text, j < ra ? 0 : delta);
+    if (lazy)
+      keep[at / KILO_LINE_BLOCK] = 1;
+  }
+  if (remap) {
+    E.map = text;
+    E.mapsize = size;
+    if (oldmap)
+      munmap(oldmap, oldmapsize);
+  }
+
+  if (lazy) {
+    size_t *oldidx = E.lineidx;
+    E.lineidx = malloc(sizeof(size_t) * (nidx ? nidx : 1));
+    free(E.blockloaded);
+    E.blockloaded = calloc(nidx ? nidx : 1, 1);
+    if (!E.lineidx || !E.blockloaded)
+      die("malloc");
+    ssize_t head = (ra + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK;
+    memcpy(E.lineidx, oldidx, sizeof(size_t) * head);
+    loadRun(&mid, loadIndexTask);
+    reloadIndexJob ij = {oldidx, (ra + newmid + KILO_LINE_BLOCK - 1) / KILO_LINE_BLOCK, nidx,
+                         ra + newmid, x, newmid - oldmid, ra + oldmid, oldmaprows, delta};
+    if (ij.last > ij.first)
+      editorRunTasks(reloadIndexTask, &ij, (ij.last - ij.first - 1) / RELOAD_INDEX_TASK + 1);
+    free(oldidx);
+    E.maprows = E.numrows;
+    for (ssize_t b = 0; b < nidx; b++) {
+      if (keep[b])
+        editorLoadBlock(b);
+    }
+    free(keep);
+  } else {
+    // the changed rows are read like editorOpenRead reads them
+    if (!remap && x > a) {
+      if (E.arena == NULL && (E.arena = createArena(ARENA_BLOCK_SIZE)) == NULL)
+        die("createArena");
+      if ((mid.text = arenaAlloc(E.arena, x - a)) == NULL)
+        die("arenaAlloc");
+      memcpy(mid.text, text + a, x - a);
+    }
+    loadRun(&mid, loadRowsTask);
+    if (!remap && text)
+      munmap(text, size);
+  }
+
+  free(E.hashes);
+  E.hashes = hashes;
+  E.nhashes = p + nmid + n - s;
+  E.hashcap = E.nhashes + 1;
+  E.filesize = size;
+  E.filestat = *st;
+  E.changed = 0;
+  E.clobber = 0;
+  // a mapped file that is still read lazily keeps its saved index in step
+  editorIndexSave(st);
+  if (ra < E.hlvalid)
+    E.hlvalid = ra;
+  // the journal holds edits to text that is gone
+  E.nundo = E.undopos = 0;
+  E.undoopen = 0;
+
+  // the cursor stays on its row, or the nearest one if that changed
+  if (E.cy >= ra + oldmid)
+    E.cy += newmid - oldmid;
+  else if (E.cy >= ra + newmid)
+    E.cy = ra + newmid - 1;
+  if (E.rowoff >= ra + oldmid)
+    E.rowoff += newmid - oldmid;
+  if (E.cy >= E.numrows)
+    E.cy = E.numrows - 1;
+  if (E.cy < 0)
+    E.cy = 0;
+  if (E.cy < E.numrows && E.cx > editorRow(E.cy)->size)
+    E.cx = editorRow(E.cy)->size;
+  if (E.findrow >= E.numrows)
+    E.findrow = -1;
+  E.findcount = -1;
+  editorSetStatusMessage("%s changed on disk, reloaded %zd of %zd lines in %.1f ms", E.filename,
+                         newmid, E.numrows, (histNow() - start) / 1e6);
+  return 1;
+}
+
+/*
+  Called from the main loop: look at the file when it may have changed,
+  reload it if it did and the buffer has no unsaved edits.
+ */
+void editorChangeCheck() {
+  // a headless editor looks at every step, there is nothing to wait on
+  if (E.follow || E.filesize < 0 || (!E.fileready && !E.term))
+    return;
+  E.fileready = 0;
+  E.filetime = histNow();
+  // a running save replaces the file itself, it's looked at once done
+  struct stat st;
+  if (E.save || stat(E.filename, &st) == -1 || !S_ISREG(st.st_mode))
+    return;
+  // a new file renamed over ours needs a new watch
+  if (st.st_ino != E.filestat.st_ino || st.st_dev != E.filestat.st_dev)
+    editorWatch();
+  if (editorSameFile(&st, &E.filestat))
+    return;
+  if (E.dirty) {
+    if (!E.changed)
+      editorSetStatusMessage("%s changed on disk, ^S will ask before overwriting it", E.filename);
+    E.changed = 1;
+    return;
+  }
+  if (!editorReload(&st))
+    editorSetStatusMessage("%s changed on disk and can't be read: %s", E.filename, strerror(errno));
+}
+
+/*
+  Write all of iov to fd, retrying short writes. Returns the number of
+  bytes written, or -1 with errno set by the write that failed.
+ */
+ssize_t writevAll(int fd, struct iovec *iov, int cnt) {
+  ssize_t total = 0;
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    total += n;
+    // skip what was written, a short write may end inside an iovec
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return total;
+}
+
+/*
+  Hash len bytes about to be written into the blocks of the saved file,
+  which become E.hashes once it is in place.
+ */
+void editorSaveHash(saveJob *job, const char *s, ssize_t len) {
+  while (len > 0) {
+    ssize_t n = KILO_HASH_BLOCK - job->hashfill;
+    if (n > len)
+      n = len;
+    hashUpdate(&job->hasher, s, n);
+    job->hashfill += n;
+    s += n;
+    len -= n;
+    if (job->hashfill == KILO_HASH_BLOCK) {
+      job->hashes[job->nhashes] = (hashBlock){job->nhashes * KILO_HASH_BLOCK, hashFinal(&job->hasher)};
+      job->nhashes++;
+      hashInit(&job->hasher);
+      job->hashfill = 0;
+    }
+  }
+}
+
+/*
+  Saver thread: stream the snapshot into a temp file next to the target,
+  fsync it and rename it over the target, so a failed save never leaves a
+  half written file behind.
+ */
+void *editorSaveThread(void *arg) {
+  saveJob *job = arg;
+  int dirlen = strlen(job->filename);
+  char *tmpname = malloc(dirlen + 16);
+  if (!tmpname) {
+    job->err = errno;
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+  snprintf(tmpname, dirlen + 16, "%s.kiloXXXXXX", job->filename);
+  int fd = mkstemp(tmpname);
+  if (fd == -1) {
+    job->err = errno;
+    free(tmpname);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+  // keep the permissions of the file we replace
+  struct stat st;
+  fchmod(fd, stat(job->filename, &st) == 0 ? st.st_mode & 07777 : 0644);
+
+  struct iovec iov[KILO_SAVE_BATCH * 3];
+  int cnt = 0;
+  ssize_t want = 0;
+  for (ssize_t j = 0; j <= job->numrows; j++) {
+    if (cnt > (KILO_SAVE_BATCH - 1) * 3 || (j == job->numrows && cnt > 0)) {
+      if (writevAll(fd, iov, cnt) == -1) {
+        job->err = errno;
+        break;
+      }
+      __atomic_add_fetch(&job->written, want, __ATOMIC_RELAXED);
+      cnt = 0;
+      want = 0;
+    }
+    if (j == job->numrows)
+      break;
+    saverow *r = &job->rows[j];
+    // text before and after the gap, then the line break
+    if (r->gap > 0)
+      iov[cnt++] = (struct iovec){r->chars, r->gap};
+    if (r->size > r->gap)
+      iov[cnt++] = (struct iovec){r->chars + r->gap + r->gaplen, r->size - r->gap};
+    iov[cnt++] = (struct iovec){"\n", 1};
+    want += r->size + 1;
+    editorSaveHash(job, r->chars, r->gap);
+    editorSaveHash(job, r->chars + r->gap + r->gaplen, r->size - r->gap);
+    editorSaveHash(job, "\n", 1);
+  }
+  if (job->hashfill > 0) {
+    job->hashes[job->nhashes] = (hashBlock){job->nhashes * KILO_HASH_BLOCK, hashFinal(&job->hasher)};
+    job->nhashes++;
+  }
+  if (job->err == 0 && fsync(fd) == -1)
+    job->err = errno;
+  if (close(fd) == -1 && job->err == 0)
+    job->err = errno;
+  if (job->err == 0 && rename(tmpname, job->filename) == -1)
+    job->err = errno;
+  if (job->err != 0)
+    unlink(tmpname);
+  free(tmpname);
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+void editorSave() {
+  if (E.filename == NULL)
+    return;
+  if (E.save) {
+    editorSetStatusMessage("Save already in progress");
+    return;
+  }
+  // don't overwrite what another program wrote since the file was read without asking
+  struct stat st;
+  if (E.filesize >= 0 && !E.clobber && stat(E.filename, &st) == 0 &&
+      !editorSameFile(&st, &E.filestat)) {
+    editorSetStatusMessage("%s changed on disk since it was read, ^S again to overwrite it", E.filename);
+    E.clobber = 1;
+    return;
+  }
+  saveJob *job = calloc(1, sizeof(saveJob));
+  if (!job)
+    die("calloc");
+  job->filename = strdup(E.filename);
+  job->numrows = E.numrows;
+  job->rows = malloc(sizeof(saverow) * (E.numrows ? E.numrows : 1));
+  if (!job->filename || !job->rows)
+    die("malloc");
+  /*
+    Snapshot the rows without copying their text: owned buffers are
+    marked shared and become read-only until the save is done, an edit
+    copies the row out first like it does for borrowed text.
+   */
+  for (ssize_t j = 0; j < E.numrows; j++) {
+    erow *row = editorRow(j);
+    job->rows[j] = (saverow){row->chars, row->size, row->gap, row->gaplen};
+    job->total += row->size + 1;
+    if (!row->borrowed) {
+      row->borrowed = 1;
+      row->shared = 1;
+    }
+  }
+  job->dirty = E.dirty;
+  job->hashes = malloc(sizeof(hashBlock) * (editorHashCount(job->total) + 1));
+  if (!job->hashes)
+    die("malloc");
+  hashInit(&job->hasher);
+  if (pthread_create(&job->thread, NULL, editorSaveThread, job) != 0) {
+    job->err = errno;
+    job->done = 1;
+    job->thread = pthread_self();
+  }
+  E.save = job;
+  editorSetStatusMessage("Saving...");
+}
+
+/*
+  Called from the main loop: report progress of a running save and clean
+  up once the saver thread has finished.
+ */
+void editorSaveCheck(int wait) {
+  saveJob *job = E.save;
+  if (!job)
+    return;
+  if (!wait && !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+    ssize_t written = __atomic_load_n(&job->written, __ATOMIC_RELAXED);
+    editorSetStatusMessage("Saving... %zd%%",
+                           job->total ? written * 100 / job->total : 100);
+    return;
+  }
+  if (!pthread_equal(job->thread, pthread_self()))
+    pthread_join(job->thread, NULL);
+
+  // rows still using their snapshot buffer own it again
+  for (ssize_t j = 0; j < E.numrows; j++) {
+    erow *row = &E.row[j];
+    if (row->shared) {
+      row->shared = 0;
+      row->borrowed = 0;
+    }
+  }
+  for (int j = 0; j < E.nretired; j++)
+    free(E.retired[j]);
+  E.nretired = 0;
+
+  if (job->err == 0) {
+    editorSetStatusMessage("%zd bytes written to disk", job->total);
+    // the saved file is a new one, watch it and remember what it holds
+    struct stat st;
+    if (stat(E.filename, &st) == 0 && S_ISREG(st.st_mode)) {
+      E.filestat = st;
+      free(E.hashes);
+      E.hashes = job->hashes;
+      E.nhashes = job->nhashes;
+      E.hashcap = editorHashCount(job->total) + 1;
+      job->hashes = NULL;
+      E.filesize = job->total;
+      E.mapstale = E.map != NULL;
+      E.changed = 0;
+      E.clobber = 0;
+      editorWatch();
+    }
+    // follow it from where the rows end
+    if (E.follow)
+      editorFollowOpen(job->total);
+    // edits made while saving keep the file modified
+    if (E.dirty == job->dirty)
+      E.dirty = 0;
+  } else {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+  }
+  free(job->filename);
+  free(job->rows);
+  free(job->hashes);
+  free(job);
+  E.save = NULL;
+}
+
+
+/*** append buffer, used to refresh editor in 1 step ***/
+
+/*
+  Make room for n more bytes. Capacity doubles, and buffers are reused
+  across frames by resetting len, so a steady redraw doesn't allocate.
+ */
+int abReserve(struct abuf *ab, ssize_t n) {
+  if (ab->len + n <= ab->cap)
+    return 0;
+  ssize_t cap = ab->cap ? ab->cap * 2 : 256;
+  while (cap < ab->len + n)
+    cap *= 2;
+  char *new = realloc(ab->b, cap);
+  if (new == NULL)
+    return -1;
+  ab->b = new;
+  ab->cap = cap;
+  return 0;
+}
+
+void abAppend(struct abuf *ab, const char *s, ssize_t len) {
+  // allocate more memory
+  if (abReserve(ab, len) == -1)
+    return;
+  memcpy(&ab->b[ab->len], s, len);
+  ab->len += len;
+}
+
+/* append n copies of c, used for padding */
+void abAppendFill(struct abuf *ab, char c, ssize_t n) {
+  if (n <= 0 || abReserve(ab, n) == -1)
+    return;
+  memset(&ab->b[ab->len], c, n);
+  ab->len += n;
+}
+
+void abFree(struct abuf *ab) {
+  free(ab->b);
+  ab->b = NULL;
+  ab->len = 0;
+  ab->cap = 0;
+}
+
+/*** whole file search ***/
+
+/* one slice of rows searched by one pool task */
+typedef struct searchTask {
+  ssize_t first, last; // rows [first, last)
+  long count; // matches found
+  ssize_t *rows; // rows with a match, in order, if the job collects them
+  ssize_t nrows;
+  ssize_t rowcap;
+} searchTask;
+
+typedef struct searchJob {
+  const char *query;
+  size_t qlen;
+  int collect; // also record which rows match
+  int cancel; // set by the main thread to stop the workers early
+  searchTask *tasks;
+  int ntasks;
+} searchJob;
+
+static void searchAddRow(searchTask *t, ssize_t row) {
+  if (t->nrows == t->rowcap) {
+    t->rowcap = t->rowcap ? t->rowcap * 2 : 64;
+    ssize_t *new = realloc(t->rows, sizeof(ssize_t) * t->rowcap);
+    if (new == NULL) {
+      // out of memory, keep the count going without the row list
+      return;
+    }
+    t->rows = new;
+  }
+  t->rows[t->nrows++] = row;
+}
+
+/*
+  Search rows of a mapped file that were never materialized straight in
+  the mapping, without building their erows. Lines are counted as the
+  matches are found.
+ */
+static void searchMappedBlock(searchJob *job, searchTask *t, ssize_t block) {
+  const char *p = E.map + E.lineidx[block];
+  ssize_t first = block * KILO_LINE_BLOCK;
+  ssize_t last = first + KILO_LINE_BLOCK;
+  const char *end = last < E.maprows ? E.map + E.lineidx[block + 1] : E.map + E.mapsize;
+  ssize_t row = first;
+  const char *m;
+  while ((m = searchMem(p, end - p, job->query, job->qlen))) {
+    // advance to the line holding the match
+    const char *nl;
+    while ((nl = memchr(p, '\n', m - p))) {
+      p = nl + 1;
+      row++;
+    }
+    t->count++;
+    if (job->collect && (t->nrows == 0 || t->rows[t->nrows - 1] != row))
+      searchAddRow(t, row);
+    // a match can't span lines, the query has no line breaks
+    p = m + job->qlen;
+  }
+}
+
+static void searchTaskRun(void *ctx, int task) {
+  searchJob *job = ctx;
+  searchTask *t = &job->tasks[task];
+  for (ssize_t j = t->first; j < t->last; j++) {
+    if (j % KILO_LINE_BLOCK == 0) {
+      if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+        return;
+      ssize_t block = j / KILO_LINE_BLOCK;
+      if (j < E.maprows && !E.blockloaded[block]) {
+        searchMappedBlock(job, t, block);
+        j += KILO_LINE_BLOCK - 1;
+        continue;
+      }
+    }
+    // editorSearchRows left every gap at the end of its row
+    erow *row = &E.row[j];
+    const char *p = row->chars;
+    const char *end = row->chars + row->size;
+    const char *m;
+    int found = 0;
+    while ((m = searchMem(p, end - p, job->query, job->qlen))) {
+      t->count++;
+      found = 1;
+      p = m + job->qlen;
+    }
+    if (found && job->collect)
+      searchAddRow(t, j);
+  }
+}
+
+/* use n workers for whole file searches from now on */
+void editorSetSearchThreads(int n) {
+  destroyPool(E.pool);
+  E.pool = createPool(n);
+  if (E.pool == NULL)
+    die("createPool");
+}
+
+/*
+  Search every row for query on the worker pool. Rows are split into
+  tasks of KILO_SEARCH_TASK rows whose results are merged in row order.
+  If cancelable, the main thread watches the terminal while the workers
+  run and a key press cancels the search. Returns the number of matches,
+  or -1 if it was cancelled. With rows set, *rows and *nrows get the
+  matching rows, which the caller frees.
+ */
+long editorSearchRows(const char *query, size_t qlen, ssize_t **rows, ssize_t *nrows,
+                      int cancelable) {
+  if (qlen == 0)
+    return 0;
+  // workers read rows without moving gaps, put every gap at the end first
+  for (ssize_t j = 0; j < E.numrows; j++) {
+    if (j < E.maprows && !E.blockloaded[j / KILO_LINE_BLOCK]) {
+      j += KILO_LINE_BLOCK - 1;
+      continue;
+    }
+    erow *row = &E.row[j];
+    if (row->gap != row->size)
+      editorRowMoveGap(row, row->size);
+  }
+
+  searchJob job = {query, qlen, rows != NULL, 0, NULL, 0};
+  job.ntasks = (E.numrows + KILO_SEARCH_TASK - 1) / KILO_SEARCH_TASK;
+  job.tasks = calloc(job.ntasks ? job.ntasks : 1, sizeof(searchTask));
+  if (job.tasks == NULL)
+    die("calloc");
+  for (int i = 0; i < job.ntasks; i++) {
+    job.tasks[i].first = i * KILO_SEARCH_TASK;
+    job.tasks[i].last = (i + 1) * KILO_SEARCH_TASK;
+    if (job.tasks[i].last > E.numrows)
+      job.tasks[i].last = E.numrows;
+  }
+  poolSubmit(editorPool(), searchTaskRun, &job, job.ntasks);
+  while (!poolWait(E.pool, KILO_SEARCH_POLL)) {
+    if (!cancelable)
+      continue;
+    // a new key means the query changed or the user moved on
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (E.inpos < E.inlen || (!E.term && poll(&pfd, 1, 0) == 1))
+      __atomic_store_n(&job.cancel, 1, __ATOMIC_RELAXED);
+  }
+
+  long count = 0;
+  ssize_t total = 0;
+  for (int i = 0; i < job.ntasks; i++) {
+    count += job.tasks[i].count;
+    total += job.tasks[i].nrows;
+  }
+  if (rows && !job.cancel) {
+    *rows = malloc(sizeof(ssize_t) * (total ? total : 1));
+    *nrows = 0;
+    for (int i = 0; *rows && i < job.ntasks; i++) {
+      memcpy(&(*rows)[*nrows], job.tasks[i].rows, sizeof(ssize_t) * job.tasks[i].nrows);
+      *nrows += job.tasks[i].nrows;
+    }
+  }
+  for (int i = 0; i < job.ntasks; i++)
+    free(job.tasks[i].rows);
+  free(job.tasks);
+  return job.cancel ? -1 : count;
+}
+
+/*** find ***/
+
+/*
+  Leftmost match of query in text[from, len), or of E.findregex when
+  searching for a regular expression. Returns its start and sets *mlen,
+  or returns -1.
+ */
+ssize_t editorMatchIn(const char *query, size_t qlen, const char *text, ssize_t len,
+                      ssize_t from, ssize_t *mlen) {
+  if (from > len)
+    return -1;
+  if (E.findisregex) {
+    size_t ms, ml;
+    if (!E.findregex || !regexSearch(E.findregex, text, len, from, &ms, &ml))
+      return -1;
+    *mlen = ml;
+    return ms;
+  }
+  const char *m = searchMem(text + from, len - from, query, qlen);
+  *mlen = qlen;
+  return m ? m - text : -1;
+}
+
+/* last match of the running search starting before limit, or -1 */
+ssize_t editorMatchLast(const char *query, size_t qlen, const char *text, ssize_t len,
+                        size_t limit) {
+  if (!E.findisregex) {
+    const char *m = searchMemLast(text, limit, len, query, qlen);
+    return m ? m - text : -1;
+  }
+  ssize_t last = -1, from = 0, m, mlen;
+  while ((size_t)from < limit &&
+         (m = editorMatchIn(query, qlen, text, len, from, &mlen)) != -1 &&
+         (size_t)m < limit) {
+    last = m;
+    from = m + 1;
+  }
+  return last;
+}
+
+/*
+  Find the next match of query starting at row, col and moving in dir.
+  Rows are searched in place; wraps around the end of the file once.
+  Returns 1 and sets *mrow, *mcol if there is a match.
+ */
+int editorFindFrom(const char *query, size_t qlen, ssize_t row, ssize_t col, ssize_t dir,
+                   ssize_t *mrow, ssize_t *mcol) {
+  if (E.numrows == 0)
+    return 0;
+  for (ssize_t n = 0; n <= E.numrows; n++) {
+    if (row < 0) {
+      row = E.numrows - 1;
+      col = -1;
+    } else if (row >= E.numrows) {
+      row = 0;
+      col = 0;
+    }
+    erow *r = editorRow(row);
+    const char *text = editorRowText(r);
+    ssize_t m, mlen;
+    if (dir == 1) {
+      if (col < 0) col = 0;
+      m = editorMatchIn(query, qlen, text, r->size, col, &mlen);
+    } else {
+      // col -1 means anywhere in the row
+      size_t limit = col < 0 ? (size_t)r->size + 1 : (size_t)col;
+      m = editorMatchLast(query, qlen, text, r->size, limit);
+    }
+    if (m != -1) {
+      *mrow = row;
+      *mcol = m;
+      return 1;
+    }
+    row += dir;
+    col = dir == 1 ? 0 : -1;
+  }
+  return 0;
+}
+
+void editorFindCallback(char *query, int key) {
+  size_t qlen = strlen(query);
+  if (key == '\r' || key == '\x1b') {
+    if (key == '\r' && E.finderr)
+      editorSetStatusMessage("Bad regex: %s", E.finderr);
+    E.findquery = NULL;
+    E.findrow = -1;
+    regexFree(E.findregex);
+    E.findregex = NULL;
+    E.finderr = NULL;
+    return;
+  }
+  E.findquery = query;
+  E.findlen = qlen;
+  int moved = key == ARROW_RIGHT || key == ARROW_DOWN ||
+              key == ARROW_LEFT || key == ARROW_UP;
+  if (E.findisregex && !moved) {
+    // compile once per edit of the query, not per row searched
+    regexFree(E.findregex);
+    E.finderr = NULL;
+    E.findregex = qlen ? regexCompile(query, &E.finderr) : NULL;
+    if (!E.findregex) {
+      E.findrow = -1;
+      E.findcount = -1;
+      return;
+    }
+  }
+  if (qlen == 0) {
+    E.findrow = -1;
+    E.findcount = -1;
+    return;
+  }
+
+  ssize_t row, col;
+  ssize_t dir = 1;
+  if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+    row = E.findrow == -1 ? E.findorigrow : E.findrow;
+    col = E.findrow == -1 ? E.findorigcol : E.findcol + 1;
+  } else if (key == ARROW_LEFT || key == ARROW_UP) {
+    dir = -1;
+    row = E.findrow == -1 ? E.findorigrow : E.findrow;
+    col = E.findrow == -1 ? E.findorigcol : E.findcol;
+  } else if (E.findrow != -1 && qlen > E.findprevlen && !E.findisregex) {
+    /*
+      the query only grew, so the next match can't be before the current
+      one: carry on from there instead of from the start. A longer regex
+      can match earlier ("a" then "a|b"), so it starts over.
+     */
+    row = E.findrow;
+    col = E.findcol;
+  } else {
+    row = E.findorigrow;
+    col = E.findorigcol;
+  }
+  E.findprevlen = qlen;
+
+  ssize_t mrow, mcol;
+  if (editorFindFrom(query, qlen, row, col, dir, &mrow, &mcol)) {
+    E.findrow = mrow;
+    E.findcol = mcol;
+    E.cy = mrow;
+    E.cx = mcol;
+    // scroll so the match ends up at the top of the screen
+    E.rowoff = E.numrows;
+  } else {
+    E.findrow = -1;
+  }
+  /*
+    count all matches of a new query, typing the next key cancels it.
+    The lazy DFA fills its cache as it runs, so regex matches aren't
+    counted on the worker threads.
+   */
+  if (E.findisregex)
+    E.findcount = -1;
+  else if (!moved)
+    E.findcount = editorSearchRows(query, qlen, NULL, NULL, 1);
+}
+
+/*
+  Ctrl-G: list every row matching a query in a panel over the text.
+  Arrows and Page Up/Down pick a row, Enter jumps to it, Escape closes.
+ */
+void editorGrep() {
+  char *query = editorPrompt("List lines matching: %s (ESC to cancel)", NULL);
+  if (query == NULL)
+    return;
+  ssize_t *rows = NULL, nrows = 0;
+  editorSetStatusMessage("Searching...");
+  editorRefreshScreen();
+  long count = editorSearchRows(query, strlen(query), &rows, &nrows, 1);
+  if (count == -1) {
+    editorSetStatusMessage("Search cancelled");
+    free(query);
+    return;
+  }
+  if (nrows == 0) {
+    editorSetStatusMessage("No lines match \"%s\"", query);
+    free(rows);
+    free(query);
+    return;
+  }
+
+  E.panelrows = rows;
+  E.panelcount = nrows;
+  E.panelsel = 0;
+  E.paneloff = 0;
+  E.findquery = query;
+  E.findlen = strlen(query);
+  editorSetStatusMessage("%ld matches on %zd lines (Arrows/Enter/ESC)", count, nrows);
+  while (1) {
+    // keep the selection on screen
+    if (E.panelsel < E.paneloff)
+      E.paneloff = E.panelsel;
+    if (E.panelsel >= E.paneloff + E.screenrows)
+      E.paneloff = E.panelsel - E.screenrows + 1;
+    editorSaveCheck(0);
+    editorRefreshScreen();
+    int c = editorReadKey();
+    if (c == ARROW_UP && E.panelsel > 0) {
+      E.panelsel--;
+    } else if (c == ARROW_DOWN && E.panelsel < nrows - 1) {
+      E.panelsel++;
+    } else if (c == PAGE_UP) {
+      E.panelsel = E.panelsel > E.screenrows ? E.panelsel - E.screenrows : 0;
+    } else if (c == PAGE_DOWN) {
+      E.panelsel += E.screenrows;
+      if (E.panelsel > nrows - 1)
+        E.panelsel = nrows - 1;
+    } else if (c == '\r') {
+      // jump to the first match in the picked row
+      E.cy = rows[E.panelsel];
+      erow *row = editorRow(E.cy);
+      const char *text = editorRowText(row);
+      const char *m = searchMem(text, row->size, query, E.findlen);
+      E.cx = m ? m - text : 0;
+      E.rowoff = E.cy;
+      break;
+    } else if (c == '\x1b') {
+      break;
+    }
   }
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+  E.panelrows = NULL;
+  E.findquery = NULL;
+  editorSetStatusMessage("");
+  free(rows);
+  free(query);
 }
 
-void editorSave() {
-  if (E.filename == NULL)
-    return;
-  int len;
-  char *buf = editorRowsToString(&len);
-  // open a file to read and write, create if it doesn't exist, 0644 is the permission on file.
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    /*
-      truncate file till len
-      ftruncate() sets the file’s size to the specified length. If the file is
-      larger than that, it will cut off any data at the end of the file to make
-      it that length. If the file is shorter, it will add 0 bytes at the end to
-      make it that length.
-
-      The normal way to overwrite a file is to pass the O_TRUNC flag to open(),
-      which truncates the file completely, making it an empty file, before
-      writing the new data into it. By truncating the file ourselves to the same
-      length as the data we are planning to write into it, we are making the
-      whole overwriting operation a little bit safer in =case the ftruncate()
-      call succeeds but the write() call fails. In that case, the file would
-      still contain most of the data it had before. But if the file was
-      truncated completely by the open() call and then the write() failed, you’d
-      end up with all of your data lost.
-
-      More advanced editors will write to a new, temporary file, and then rename
-      that file to the actual file the user wants to overwrite, and they’ll
-      carefully check for errors through the whole process.
-    */
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        editorSetStatusMessage("%d bytes written to disk", len);
-        E.dirty = 0;
-        return;
-      }
-    }
-    close(fd);
+/* Ctrl-F searches for text, Ctrl-R for a regular expression */
+void editorFind(int regex) {
+  ssize_t saved_cx = E.cx;
+  ssize_t saved_cy = E.cy;
+  ssize_t saved_coloff = E.coloff;
+  ssize_t saved_rowoff = E.rowoff;
+  ssize_t saved_wrapoff = E.wrapoff;
+
+  E.findrow = -1;
+  E.findprevlen = 0;
+  E.findorigrow = E.cy;
+  E.findorigcol = E.cx;
+  E.findisregex = regex;
+  char *query = editorPrompt(regex ? "Regex: %s (Use ESC/Arrows/Enter)"
+                                   : "Search: %s (Use ESC/Arrows/Enter)",
+                             editorFindCallback);
+  E.findisregex = 0;
+  if (query) {
+    free(query);
+  } else {
+    // cancelled, go back to where the search started
+    E.cx = saved_cx;
+    E.cy = saved_cy;
+    E.coloff = saved_coloff;
+    E.rowoff = saved_rowoff;
+    E.wrapoff = saved_wrapoff;
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
+/*** go to line ***/
 
-/*** append buffer, used to refresh editor in 1 step ***/
-struct abuf {
-  char *b;
-  int len;
-};
-
-#define ABUF_INIT                                                              \
-  { NULL, 0 }
+/*
+  Put the cursor at the start of row at, with the row in the middle of
+  the screen if it was off it. Nothing is walked to get there: a mapped
+  file only materializes the block holding the row, found by E.lineidx.
+ */
+void editorGoToRow(ssize_t at) {
+  if (at > E.numrows - 1)
+    at = E.numrows - 1;
+  if (at < 0)
+    at = 0;
+  E.cy = at;
+  E.cx = 0;
+  if (at < E.rowoff || at >= E.rowoff + E.screenrows) {
+    E.rowoff = at > E.screenrows / 2 ? at - E.screenrows / 2 : 0;
+    E.wrapoff = 0;
+  }
+}
 
-void abAppend(struct abuf *ab, const char *s, int len) {
-  // allocate more memory
-  char *new = realloc(ab->b, ab->len + len);
-  if (new == NULL)
+/*
+  ^N asks where to go: a line number, a percentage of the file like 50%,
+  or +N and -N lines from the cursor.
+ */
+void editorGoTo() {
+  char *query = editorPrompt("Go to line: %s (N, N%% of the file, +N or -N)", NULL);
+  if (query == NULL)
     return;
-  memcpy(&new[ab->len], s, len);
-  ab->b = new;
-  ab->len += len;
+  const char *p = query;
+  while (*p == ' ')
+    p++;
+  int sign = *p == '+' ? 1 : *p == '-' ? -1 : 0;
+  if (sign)
+    p++;
+  char *end;
+  long long n = isdigit((unsigned char)*p) ? strtoll(p, &end, 10) : -1;
+  int percent = n >= 0 && *end == '%';
+  if (percent)
+    end++;
+  while (n >= 0 && *end == ' ')
+    end++;
+  if (n < 0 || *end != '\0' || (sign && percent)) {
+    editorSetStatusMessage("Not a line to go to: %s", query);
+  } else if (percent) {
+    editorGoToRow((E.numrows - 1) * (n < 100 ? n : 100) / 100);
+  } else {
+    // past the last row is the last row
+    if (n > E.numrows)
+      n = E.numrows;
+    editorGoToRow(sign ? E.cy + sign * n : n - 1);
+  }
+  free(query);
 }
 
-void abFree(struct abuf *ab) {
-  free(ab->b);
+/*** input, moving cursor position using arrow keys ***/
+
+/* column of cx, a binary search over the tabs and multibyte chars before it */
+ssize_t editorRowCxToRx(erow *row, ssize_t cx) {
+  if (row->colstale)
+    editorRowBuildCols(row);
+  colindex *ci = row->cols;
+  ssize_t i = ci ? editorColsFind(ci, cx) : 0;
+  if (i == 0)
+    return cx;
+  colchar *e = &ci->c[i - 1];
+  return e->rx + e->width + (cx - e->cx - e->len);
 }
 
-/*** input, moving cursor position using arrow keys ***/
+/* cx of the char drawn at column rx, or the end of the row */
+ssize_t editorRowRxToCx(erow *row, ssize_t rx) {
+  if (row->colstale)
+    editorRowBuildCols(row);
+  colindex *ci = row->cols;
+  // last entry starting at or before rx
+  ssize_t lo = 0, hi = ci ? ci->n : 0;
+  while (lo < hi) {
+    ssize_t mid = (lo + hi) / 2;
+    if (ci->c[mid].rx <= rx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  ssize_t cx;
+  if (lo == 0) {
+    cx = rx;
+  } else {
+    colchar *e = &ci->c[lo - 1];
+    if (rx < e->rx + e->width)
+      return e->cx;
+    cx = e->cx + e->len + (rx - e->rx - e->width);
+  }
+  return cx < row->size ? cx : row->size;
+}
 
-int editorRowCxToRx(erow *row, int cx) {
-  int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t') {
-      int current_rx = rx;
-      // this handles the case when u r in the middle of the tab
-      rx += (KILO_TAB_STOP - 1)  - (rx % KILO_TAB_STOP);
-      info(E.logger, "Encountered tab at rx %d and now rx is %d", current_rx, rx);
-    }
-    rx++;
+/* start of the char after the one at cx, skipping combining marks */
+ssize_t editorRowNextChar(erow *row, ssize_t cx) {
+  if (row->rstale)
+    editorUpdateRow(row);
+  if (row->ascii)
+    return cx + 1;
+  const char *text = editorRowText(row);
+  ssize_t rx = 0;
+  editorRenderStep(text, row->size, &cx, &rx);
+  while (cx < row->size) {
+    ssize_t next = cx, w = 0;
+    editorRenderStep(text, row->size, &next, &w);
+    if (w != 0)
+      break;
+    cx = next;
+  }
+  return cx;
+}
+
+/* start of the char before cx, including the marks combined with it */
+ssize_t editorRowPrevChar(erow *row, ssize_t cx) {
+  if (row->rstale)
+    editorUpdateRow(row);
+  if (row->ascii)
+    return cx - 1;
+  const char *text = editorRowText(row);
+  while (cx > 0) {
+    // back over continuation bytes to the lead byte
+    ssize_t start = cx - 1;
+    while (start > 0 && cx - start < 4 && (text[start] & 0xc0) == 0x80)
+      start--;
+    ssize_t next = start, w = 0;
+    editorRenderStep(text, row->size, &next, &w);
+    // a stray continuation byte is a char of its own
+    cx = next == cx ? start : cx - 1;
+    if (w != 0 || cx == 0)
+      break;
   }
-  return rx;
+  return cx;
 }
 
 void editorMoveCursor(int key) {
-  erow *row  = (E.cy >= E.numrows) ? NULL: &E.row[E.cy];
+  erow *row  = (E.cy >= E.numrows) ? NULL: editorRow(E.cy);
+  // column to keep when moving to another row
+  ssize_t rx = row ? editorRowCxToRx(row, E.cx) : 0;
   switch (key) {
   case ARROW_LEFT:
-    if (E.cx != 0){
-      E.cx--;
+    if (row && E.cx != 0){
+      E.cx = editorRowPrevChar(row, E.cx);
     }
     break;
   case ARROW_RIGHT:
     if (row && E.cx < row->size) {
-     E.cx++;
+     E.cx = editorRowNextChar(row, E.cx);
     }
     break;
   case ARROW_UP:
@@ -509,14 +3482,110 @@ void editorMoveCursor(int key) {
   }
 
   // snap back the cursor horizontally if use moves to a line shorter than previous line.
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-  int rowlen = row ? row->size : 0;
+  row = (E.cy >= E.numrows) ? NULL : editorRow(E.cy);
+  if (key == ARROW_UP || key == ARROW_DOWN)
+    E.cx = row ? editorRowRxToCx(row, rx) : 0;
+  ssize_t rowlen = row ? row->size : 0;
   if (E.cx > rowlen) {
     E.cx = rowlen;
   }
 
 }
 
+/*
+  Page up or down: the screen and the cursor move a screen of rows in one
+  step, the cursor keeping its column.
+ */
+void editorPage(int key) {
+  ssize_t move = key == PAGE_UP ? -E.screenrows : E.screenrows;
+  erow *row = E.cy < E.numrows ? editorRow(E.cy) : NULL;
+  ssize_t rx = row ? editorRowCxToRx(row, E.cx) : 0;
+  ssize_t last = E.numrows + 1 - E.screenrows;
+  E.rowoff += move;
+  if (E.rowoff > last)
+    E.rowoff = last;
+  if (E.rowoff < 0)
+    E.rowoff = 0;
+  E.cy += move;
+  if (E.cy > E.numrows)
+    E.cy = E.numrows;
+  if (E.cy < 0)
+    E.cy = 0;
+  row = E.cy < E.numrows ? editorRow(E.cy) : NULL;
+  E.cx = row ? editorRowRxToCx(row, rx) : 0;
+}
+
+/*
+  Show prompt in the message bar and let the user type a line. callback,
+  if given, runs after every key with the text so far. Returns the text,
+  or NULL if the user pressed Escape.
+ */
+char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+  size_t bufsize = 128;
+  char *buf = malloc(bufsize);
+  if (buf == NULL)
+    die("malloc");
+  size_t buflen = 0;
+  buf[0] = '\0';
+
+  while (1) {
+    editorSetStatusMessage(prompt, buf);
+    editorSaveCheck(0);
+    editorFollowCheck();
+    editorRefreshScreen();
+
+    int c = editorReadKey();
+    const char *add = NULL;
+    size_t addlen = 0;
+    char ch;
+    if (c == NO_KEY) {
+      continue;
+    } else if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+      if (buflen != 0)
+        buf[--buflen] = '\0';
+    } else if (c == '\x1b') {
+      editorSetStatusMessage("");
+      if (callback)
+        callback(buf, c);
+      free(buf);
+      return NULL;
+    } else if (c == '\r') {
+      if (buflen != 0) {
+        editorSetStatusMessage("");
+        if (callback)
+          callback(buf, c);
+        return buf;
+      }
+    } else if (c == PASTE_START) {
+      // a paste goes into the prompt up to its first line break
+      editorReadPaste();
+      add = E.paste.b;
+      addlen = 0;
+      while (addlen < (size_t)E.paste.len && add[addlen] != '\r' && add[addlen] != '\n')
+        addlen++;
+    } else if (!iscntrl(c) && c < 256) {
+      // bytes of UTF-8 chars come one key at a time
+      ch = c;
+      add = &ch;
+      addlen = 1;
+    }
+    if (addlen) {
+      while (buflen + addlen + 1 > bufsize) {
+        bufsize *= 2;
+        buf = realloc(buf, bufsize);
+        if (buf == NULL)
+          die("realloc");
+      }
+      memcpy(&buf[buflen], add, addlen);
+      buflen += addlen;
+      buf[buflen] = '\0';
+    }
+
+    if (callback)
+      callback(buf, c);
+  }
+}
+
 void editorProcessKeypress() {
   static int quit_times = KILO_QUIT_TIMES;
   int c = editorReadKey();
@@ -534,8 +3603,22 @@ void editorProcessKeypress() {
       quit_times--;
       return;
     }
+    // let a running save finish before leaving
+    editorSaveCheck(1);
+    if (E.term) {
+      E.quit = 1;
+      return;
+    }
+    editorPerfDump();
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
+    info(E.logger, "%ld frames, %ld bytes written, %ld bytes per frame",
+         E.frames, E.totalbytes, E.frames ? E.totalbytes / E.frames : 0);
+    info(E.logger, "undo journal: %d records, %ld bytes of text",
+         E.nundo, E.undobytes);
+    // stop waits for the log writer to write out everything queued
+    stop(E.logger);
+    E.logger = NULL;
     exit(0);
     break;
 
@@ -543,6 +3626,42 @@ void editorProcessKeypress() {
     editorSave();
     break;
 
+  case CTRL_KEY('f'):
+    editorFind(0);
+    break;
+
+  case CTRL_KEY('r'):
+    editorFind(1);
+    break;
+
+  case CTRL_KEY('g'):
+    editorGrep();
+    break;
+
+  case CTRL_KEY('t'):
+    editorSetFollow(!E.follow);
+    break;
+
+  case CTRL_KEY('z'):
+    editorUndo();
+    break;
+
+  case CTRL_KEY('y'):
+    editorRedo();
+    break;
+
+  case CTRL_KEY('p'):
+    E.perfshow = !E.perfshow;
+    break;
+
+  case NO_KEY:
+    return;
+
+  case PASTE_START:
+    editorReadPaste();
+    editorInsertText(E.paste.b, E.paste.len);
+    break;
+
  /***
      We also handle the Ctrl-H key combination, which sends the control code
      8,which is originally what the Backspace character would send back in
@@ -570,17 +3689,24 @@ void editorProcessKeypress() {
   /* move to the end of the line */
   case CTRL_KEY('e'):
     if (E.cy > 0) {
-      E.cx = E.row[E.cy].size;
+      E.cx = editorRow(E.cy)->size;
     }
     break;
+  case CTRL_KEY('w'):
+    editorSetWrap(!E.wrap);
+    break;
+
+  case CTRL_KEY('n'):
+    editorGoTo();
+    break;
+
   case PAGE_UP:
-  case PAGE_DOWN: {
-    int times = E.screenrows;
-    while (times--) {
-      editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-    }
-  }
-  break;
+  case PAGE_DOWN:
+    if (E.wrap)
+      editorWrapPage(c);
+    else
+      editorPage(c);
+    break;
 
   case ARROW_RIGHT:
   case ARROW_LEFT:
@@ -592,11 +3718,14 @@ void editorProcessKeypress() {
     /***
 
         Ctrl-L is traditionally used to refresh the screen in
-        terminal programs. In our text editor, the screen
-        refreshes after any keypress, so we don’t have
-        to do anything else to implement that feature.
+        terminal programs. The screen refreshes after any keypress
+        but only redraws lines that changed, so Ctrl-L forgets
+        what is on screen and makes the next refresh draw everything.
     ***/
   case CTRL_KEY('l'):
+    editorInvalidateScreen();
+    break;
+
   case '\x1b':
     break;
 
@@ -608,6 +3737,164 @@ void editorProcessKeypress() {
   quit_times = KILO_QUIT_TIMES;
 }
 
+/*** soft wrap ***/
+
+/*
+  With ^W rows wider than the screen go on over the screen lines below
+  instead of being scrolled sideways. E.wraplines counts the screen lines
+  of every row, so the screen line of a row and the row on a screen line
+  are found in O(log n). Building it doesn't look at any text: rows start
+  out counted as one line and are measured when they are drawn, scrolled
+  or paged over, which keeps the counts right wherever the screen goes.
+  Resizing the terminal marks it to be built again the next time it is
+  used, inserting and removing rows only renumbers the rows after them.
+ */
+void editorWrapInvalidate() {
+  E.wrapcols = 0;
+}
+
+/* rows [at, at + removed) were replaced by inserted new ones, counted as one line each */
+void editorWrapRows(ssize_t at, ssize_t removed, ssize_t inserted) {
+  // rows past the index are appended to it when it is next used
+  if (E.wrapcols == 0 || at >= E.wraplines.n)
+    return;
+  if (removed > E.wraplines.n - at)
+    removed = E.wraplines.n - at;
+  if (removed > 0)
+    fenwickRemove(&E.wraplines, at, removed);
+  if (inserted > 0 && !fenwickInsert(&E.wraplines, at, inserted, 1))
+    die("fenwickInsert");
+}
+
+/* bring E.wraplines to the screen width and number of rows */
+void editorWrapIndex() {
+  if (E.wrapcols != E.screencols || E.wraplines.n > E.numrows) {
+    if (!fenwickFill(&E.wraplines, E.numrows, 1))
+      die("fenwickFill");
+    E.wrapcols = E.screencols;
+  }
+  // rows appended since, by following the file
+  while (E.wraplines.n < E.numrows) {
+    if (!fenwickPush(&E.wraplines, 1))
+      die("fenwickPush");
+  }
+}
+
+/* screen lines row at takes, measured and corrected in the index */
+ssize_t editorWrapMeasure(ssize_t at) {
+  erow *row = editorRow(at);
+  ssize_t width = editorRowCxToRx(row, row->size);
+  ssize_t lines = width > 0 ? (width - 1) / E.screencols + 1 : 1;
+  int64_t counted = fenwickGet(&E.wraplines, at);
+  if (lines != counted)
+    fenwickAdd(&E.wraplines, at, lines - counted);
+  return lines;
+}
+
+/* screen line of the top of the screen, counted from the start of the file */
+int64_t editorWrapTop() {
+  return fenwickSum(&E.wraplines, E.rowoff) + E.wrapoff;
+}
+
+/* measure the rows on screen, so drawing can look them up in the index */
+void editorWrapMeasureScreen() {
+  if (E.rowoff < E.numrows) {
+    ssize_t lines = editorWrapMeasure(E.rowoff);
+    if (E.wrapoff >= lines)
+      E.wrapoff = lines - 1;
+  } else {
+    E.wrapoff = 0;
+  }
+  ssize_t y = -E.wrapoff;
+  for (ssize_t r = E.rowoff; r < E.numrows && y < E.screenrows; r++)
+    y += editorWrapMeasure(r);
+}
+
+/*
+  editorScroll while wrapping: bring the screen line of the cursor on
+  screen and work out where the cursor is drawn. E.rx is up to date.
+ */
+void editorWrapScroll() {
+  editorWrapIndex();
+  E.coloff = 0;
+  if (E.rowoff > E.numrows)
+    E.rowoff = E.numrows;
+  ssize_t lines = E.cy < E.numrows ? editorWrapMeasure(E.cy) : 1;
+  ssize_t seg = E.rx / E.screencols;
+  if (seg >= lines)
+    seg = lines - 1;
+  if (E.cy < E.rowoff || (E.cy == E.rowoff && seg < E.wrapoff)) {
+    E.rowoff = E.cy;
+    E.wrapoff = seg;
+  } else {
+    // lines from the top of the screen to the cursor, while they may fit
+    ssize_t y = seg - E.wrapoff;
+    for (ssize_t r = E.rowoff; r < E.cy && y < E.screenrows; r++)
+      y += editorWrapMeasure(r);
+    if (y >= E.screenrows) {
+      // the cursor goes on the last line, back up a screen from it
+      ssize_t r = E.cy, off = seg, up = E.screenrows - 1;
+      while (up > off && r > 0) {
+        up -= off + 1;
+        off = editorWrapMeasure(--r) - 1;
+      }
+      E.rowoff = r;
+      E.wrapoff = up > off ? 0 : off - up;
+    }
+  }
+  editorWrapMeasureScreen();
+  E.wrapy = fenwickSum(&E.wraplines, E.cy) + seg - editorWrapTop();
+  E.wrapx = E.rx - seg * E.screencols;
+}
+
+/*
+  Page up or down while wrapping: the screen and the cursor move by the
+  height of the screen in screen lines.
+ */
+void editorWrapPage(int key) {
+  editorScroll();
+  if (key == PAGE_UP) {
+    // measure the page above first, so it moves by what will be drawn
+    ssize_t y = E.wrapoff;
+    for (ssize_t r = E.rowoff - 1; r >= 0 && y < E.screenrows; r--)
+      y += editorWrapMeasure(r);
+  }
+  int64_t top = editorWrapTop();
+  int64_t cur = top + E.wrapy;
+  int64_t last = fenwickSum(&E.wraplines, E.numrows) - 1;
+  int64_t move = key == PAGE_UP ? -E.screenrows : E.screenrows;
+  top += move;
+  cur += move;
+  if (top > last) top = last;
+  if (cur > last) cur = last;
+  if (top < 0) top = 0;
+  if (cur < 0) cur = 0;
+
+  int64_t seg;
+  E.rowoff = fenwickFind(&E.wraplines, top, &seg);
+  E.wrapoff = seg;
+  editorWrapMeasureScreen();
+  // the cursor keeps its place on the screen, now that the rows on it are measured
+  E.cy = fenwickFind(&E.wraplines, editorWrapTop() + (cur - top), &seg);
+  if (E.cy >= E.numrows) {
+    E.cy = E.numrows;
+    E.cx = 0;
+  } else {
+    E.cx = editorRowRxToCx(editorRow(E.cy), seg * E.screencols + E.wrapx);
+  }
+}
+
+/* ^W turns soft wrapping on and off */
+void editorSetWrap(int on) {
+  E.wrap = on;
+  E.wrapoff = 0;
+  E.coloff = 0;
+  if (!on) {
+    fenwickFree(&E.wraplines);
+    editorWrapInvalidate();
+  }
+}
+
 /*** output ***/
 // scroll editor on each refresh
 void editorScroll() {
@@ -619,7 +3906,11 @@ void editorScroll() {
       instead of stepping up 1 char we will skip size of tab
       or any other char that was replaced using render storage.
      */
-    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.rx = editorRowCxToRx(editorRow(E.cy), E.cx);
+  }
+  if (E.wrap) {
+    editorWrapScroll();
+    return;
   }
 
   // if offset away from current cursor position bring it back.
@@ -643,63 +3934,367 @@ void editorScroll() {
 
 }
 
+/*
+  Mark the matches of the running search in render[start, start + len)
+  of row as HL_MATCH in hl, which covers that range. Offsets are bytes
+  of render, which are columns only for ASCII rows.
+ */
+void editorMarkMatches(erow *row, ssize_t start, int len, unsigned char *hl) {
+  const char *text = editorRowText(row);
+  ssize_t end = start + len;
+  // walk cx forward once for all matches, rb is the offset in render
+  ssize_t cx = 0, rx = 0, rb = 0;
+  ssize_t from = 0, mstart, mlen;
+  while ((mstart = editorMatchIn(E.findquery, E.findlen, text, row->size,
+                                 from, &mlen)) != -1) {
+    ssize_t mend = mstart + mlen;
+    while (cx < mstart)
+      rb += editorRenderStep(text, row->size, &cx, &rx);
+    ssize_t rs = rb;
+    while (cx < mend)
+      rb += editorRenderStep(text, row->size, &cx, &rx);
+    ssize_t re = rb;
+    // an empty regex match still has to move on
+    from = mlen ? mend : mstart + 1;
+    if (rs >= end)
+      break;
+    if (rs < start) rs = start;
+    if (re > end) re = end;
+    if (rs < re)
+      memset(&hl[rs - start], HL_MATCH, re - rs);
+  }
+}
+
+/*
+  Append render[start, start + len) of row in the colors of its
+  highlighting, with matches of the running search in inverse video.
+  Only called for rows on screen.
+ */
+void editorAppendRender(struct abuf *ab, erow *row, ssize_t start, int len) {
+  int search = E.findquery && E.findlen > 0;
+  int colored = E.syntax && row->hlin != -1;
+  if (!search && !colored) {
+    abAppend(ab, &row->render[start], len);
+    return;
+  }
+  unsigned char hl[len];
+  if (colored)
+    memcpy(hl, &row->hl[start], len);
+  else
+    memset(hl, HL_NORMAL, len);
+  if (search)
+    editorMarkMatches(row, start, len, hl);
+
+  int cur = HL_NORMAL;
+  int run = 0; // first char not appended yet
+  for (int i = 0; i <= len; i++) {
+    if (i < len && hl[i] == cur)
+      continue;
+    abAppend(ab, &row->render[start + run], i - run);
+    run = i;
+    int next = i < len ? hl[i] : HL_NORMAL;
+    if (next == cur)
+      continue;
+    if (next == HL_MATCH) {
+      abAppend(ab, "\x1b[0;7m", 6);
+    } else if (cur == HL_MATCH && next == HL_NORMAL) {
+      abAppend(ab, "\x1b[m", 3);
+    } else {
+      // leaving a match resets inverse video along with the color
+      char buf[16];
+      int n = snprintf(buf, sizeof(buf), cur == HL_MATCH ? "\x1b[0;%dm" : "\x1b[%dm",
+                       syntaxColor(next));
+      abAppend(ab, buf, n);
+    }
+    cur = next;
+  }
+}
+
+/* append columns [coloff, coloff + E.screencols) of a UTF-8 row, wide chars cut by an edge as spaces */
+void editorAppendWideRow(struct abuf *ab, erow *row, ssize_t coloff) {
+  ssize_t end = coloff + E.screencols;
+  ssize_t col = 0, b = 0, lpad = 0;
+  int cp, w, n;
+  while (b < row->rsize) {
+    n = utf8Decode(&row->render[b], row->rsize - b, &cp);
+    w = utf8Width(cp);
+    if (col + w > coloff) {
+      if (col < coloff) {
+        lpad = col + w - coloff;
+        b += n;
+        col += w;
+      }
+      break;
+    }
+    b += n;
+    col += w;
+  }
+  ssize_t start = b;
+  while (b < row->rsize) {
+    n = utf8Decode(&row->render[b], row->rsize - b, &cp);
+    w = utf8Width(cp);
+    if (col + w > end)
+      break;
+    b += n;
+    col += w;
+  }
+  ssize_t rpad = b < row->rsize && col < end ? end - col : 0;
+  abAppendFill(ab, ' ', lpad);
+  if (b > start)
+    editorAppendRender(ab, row, start, b - start);
+  abAppendFill(ab, ' ', rpad);
+}
+
+/* bytes at the start of render that fit in width columns, without cutting a char */
+ssize_t editorRenderFit(erow *row, ssize_t width) {
+  if (row->ascii)
+    return row->rsize < width ? row->rsize : width;
+  ssize_t col = 0, b = 0;
+  int cp;
+  while (b < row->rsize) {
+    int n = utf8Decode(&row->render[b], row->rsize - b, &cp);
+    col += utf8Width(cp);
+    if (col > width)
+      break;
+    b += n;
+  }
+  return b;
+}
+
+/* draw line y of the matching lines panel of editorGrep */
+void editorDrawPanelRow(struct abuf *ab, int y) {
+  ssize_t i = E.paneloff + y;
+  if (i < E.panelcount) {
+    erow *row = editorRow(E.panelrows[i]);
+    if (row->rstale)
+      editorUpdateRow(row);
+    char num[32];
+    int nlen = snprintf(num, sizeof(num), "%8zd: ", E.panelrows[i] + 1);
+    if (nlen > E.screencols)
+      nlen = E.screencols;
+    ssize_t len = editorRenderFit(row, E.screencols - nlen);
+    // the selected line is drawn in inverse video
+    if (i == E.panelsel)
+      abAppend(ab, "\x1b[7m", 4);
+    abAppend(ab, num, nlen);
+    abAppend(ab, row->render, len);
+    if (i == E.panelsel)
+      abAppend(ab, "\x1b[m", 3);
+  } else {
+    abAppend(ab, "~", 1);
+  }
+  abAppend(ab, "\x1b[K", 3);
+}
+
 /***********************************************
- * Function: editorDrawRows
+ * Function: editorDrawRow
  * Parameters:
- *   - ab: Append buffer to store output
+ *   - ab: Append buffer to store the line
+ *   - y: screen row to draw
  * Purpose:
- *   Draws each row of the editor display, handling
+ *   Draws one row of the editor display, handling
  *   both file content and welcome message
  ***********************************************/
-void editorDrawRows(struct abuf *ab) {
-  // Loop through each row of the screen
-  for (int y = 0; y < E.screenrows; y++) {
-    // Calculate which row of the file we're currently drawing
-    int filerow = y + E.rowoff;
-    if (filerow >= E.numrows) {
-      // Display welcome message if no file is open
-      if (E.numrows == 0 && y == E.screenrows / 3) {
-        char welcome[80];
-        // Format welcome message with version
-        int welcomelen = snprintf(welcome, sizeof(welcome),
-                                  "Kilo editor --version %s", KILO_VERSION);
-        // Truncate welcome message if it's too long
-        if (welcomelen > E.screencols)
-          welcomelen = E.screencols;
-
-        // Center the welcome message
-        int padding = (E.screencols - welcomelen) / 2;
-        if (padding) {
-          abAppend(ab, "~", 1);
-          padding--;
-        }
-        // Add left padding spaces
-        while (padding--)
-          abAppend(ab, " ", 1);
-        abAppend(ab, welcome, welcomelen);
-      } else {
-        // Display tilde for empty lines
+void editorDrawRow(struct abuf *ab, int y) {
+  if (E.panelrows) {
+    editorDrawPanelRow(ab, y);
+    return;
+  }
+  // Calculate which row of the file we're currently drawing
+  ssize_t filerow = y + E.rowoff;
+  ssize_t coloff = E.coloff;
+  if (E.wrap) {
+    // a wrapped row is drawn a screen width at a time
+    int64_t seg;
+    filerow = fenwickFind(&E.wraplines, editorWrapTop() + y, &seg);
+    coloff = seg * E.screencols;
+  }
+  if (filerow >= E.numrows) {
+    // Display welcome message if no file is open
+    if (E.numrows == 0 && y == E.screenrows / 3) {
+      char welcome[80];
+      // Format welcome message with version
+      int welcomelen = snprintf(welcome, sizeof(welcome),
+                                "Kilo editor --version %s", KILO_VERSION);
+      // Truncate welcome message if it's too long
+      if (welcomelen > E.screencols)
+        welcomelen = E.screencols;
+
+      // Center the welcome message
+      int padding = (E.screencols - welcomelen) / 2;
+      if (padding) {
         abAppend(ab, "~", 1);
+        padding--;
       }
+      // Add left padding spaces
+      abAppendFill(ab, ' ', padding);
+      abAppend(ab, welcome, welcomelen);
     } else {
-      // Display actual file content for this row
-      int len = E.row[filerow].rsize - E.coloff;
-      if (len < 0) len = 0;
+      // Display tilde for empty lines
+      abAppend(ab, "~", 1);
+    }
+  } else {
+    // Display actual file content for this row
+    erow *row = editorRow(filerow);
+    // render is rebuilt lazily, only for rows that end up on screen
+    if (row->rstale)
+      editorUpdateRow(row);
+    if (!row->ascii) {
+      editorAppendWideRow(ab, row, coloff);
+      abAppend(ab, "\x1b[K", 3);
+      return;
+    }
+    ssize_t len = row->rsize - coloff;
+    if (len < 0) len = 0;
+
+    // Truncate line if it's longer than screen width
+    if (len > E.screencols)
+      len = E.screencols;
+    // Append a portion of the current row's text to the output buffer
+    // - ab: the append buffer to write to
+    // - &E.row[filerow].chars[coloff]: pointer to the text starting at the horizontal scroll offset
+    // - len: number of characters to append, limited by screen width
+    if (len > 0)
+      editorAppendRender(ab, row, coloff, len);
+  }
+
+  // Clear line to right of cursor
+  abAppend(ab, "\x1b[K", 3);
+}
+
+void editorAddPiece(struct abuf *src, ssize_t off, ssize_t len) {
+  if (len == 0)
+    return;
+  if (E.npieces == E.piececap) {
+    E.piececap = E.piececap ? E.piececap * 2 : 64;
+    E.pieces = realloc(E.pieces, sizeof(framepiece) * E.piececap);
+    if (E.pieces == NULL)
+      die("realloc");
+  }
+  E.pieces[E.npieces++] = (framepiece){src, off, len};
+}
+
+/*
+  Emit screen line y only if it differs from what the terminal already
+  shows. E.shadow keeps the bytes of every line of the previous frame.
+  The new line is swapped into the shadow rather than copied, and line
+  gets the old buffer back to reuse.
+ */
+void editorEmitLine(struct abuf *ab, int y, struct abuf *line) {
+  struct abuf *old = &E.shadow[y];
+  if (!E.fullredraw && old->len == line->len &&
+      memcmp(old->b, line->b, line->len) == 0)
+    return;
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+  abAppend(ab, buf, len);
+  // remember what is on screen now
+  struct abuf tmp = *old;
+  *old = *line;
+  *line = tmp;
+#if KILO_WRITEV
+  // written straight from the shadow line when the frame is flushed
+  editorAddPiece(ab, E.framemark, ab->len - E.framemark);
+  editorAddPiece(old, 0, old->len);
+  E.framemark = ab->len;
+#else
+  abAppend(ab, old->b, old->len);
+#endif
+}
 
-      // Truncate line if it's longer than screen width
-      if (len > E.screencols)
-        len = E.screencols;
-      // Append a portion of the current row's text to the output buffer
-      // - ab: the append buffer to write to
-      // - &E.row[filerow].chars[E.coloff]: pointer to the text starting at the horizontal scroll offset
-      // - len: number of characters to append, limited by screen width
-      abAppend(ab, &E.row[filerow].render[E.coloff], len);
+/*
+  Bring hl of rows [first, last] up to date. Work starts at E.hlvalid and
+  a row is only lexed again when its text or the state it starts in
+  changed, so an edit costs the rows its change of state reaches. Rows
+  far below E.hlvalid start lexing KILO_HL_SYNC rows up instead of at
+  the top, so jumping into a big file doesn't highlight all of it.
+ */
+void editorHighlightRows(ssize_t first, ssize_t last) {
+  if (!E.syntax)
+    return;
+  if (last >= E.numrows)
+    last = E.numrows - 1;
+  ssize_t at = E.hlvalid;
+  int exact = 1;
+  if (first - at > KILO_HL_SYNC) {
+    at = first - KILO_HL_SYNC;
+    exact = 0;
+  }
+  int state = 0;
+  if (at > 0) {
+    erow *prev = editorRow(at - 1);
+    if (prev->hlin != -1)
+      state = prev->hlstate;
+  }
+  for (; at <= last; at++) {
+    erow *row = editorRow(at);
+    if (row->rstale)
+      editorUpdateRow(row);
+    if (row->hlin != state) {
+      unsigned char *hl = realloc(row->hl, row->rsize ? row->rsize : 1);
+      if (hl == NULL)
+        die("realloc");
+      row->hl = hl;
+      row->hlstate = E.syntax->highlight(row->render, row->rsize, state, hl);
+      row->hlin = state;
     }
+    state = row->hlstate;
+    if (exact)
+      E.hlvalid = at + 1;
+  }
+}
+
+void editorDrawRows(struct abuf *ab) {
+  // the screen and the one below it, so paging down finds them ready
+  if (!E.panelrows)
+    editorHighlightRows(E.rowoff, E.rowoff + E.screenrows * 2);
+  // Loop through each row of the screen
+  for (int y = 0; y < E.screenrows; y++) {
+    E.line.len = 0;
+    editorDrawRow(&E.line, y);
+    editorEmitLine(ab, y, &E.line);
+  }
+}
 
-    // Clear line to right of cursor
-    abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
+/* write the frame to fd, returns the number of bytes written */
+ssize_t editorFlushFrame(int fd) {
+  struct abuf *ab = &E.frame;
+  ssize_t total = 0;
+#if KILO_WRITEV
+  editorAddPiece(ab, E.framemark, ab->len - E.framemark);
+  struct iovec iov[64];
+  int i = 0;
+  while (i < E.npieces) {
+    int cnt = 0;
+    for (; i < E.npieces && cnt < 64; i++, cnt++) {
+      iov[cnt].iov_base = E.pieces[i].src->b + E.pieces[i].off;
+      iov[cnt].iov_len = E.pieces[i].len;
+    }
+    if (E.term) {
+      for (int j = 0; j < cnt; j++) {
+        vtermWrite(E.term, iov[j].iov_base, iov[j].iov_len);
+        total += iov[j].iov_len;
+      }
+    } else {
+      ssize_t n = writevAll(fd, iov, cnt);
+      if (n > 0)
+        total += n;
+    }
   }
+  E.npieces = 0;
+  E.framemark = 0;
+#else
+  if (E.term) {
+    vtermWrite(E.term, ab->b, ab->len);
+    total = ab->len;
+  } else {
+    ssize_t n = write(fd, ab->b, ab->len);
+    if (n > 0)
+      total = n;
+  }
+#endif
+  ab->len = 0;
+  return total;
 }
 
 void editorDrawStatusBar(struct abuf *ab) {
@@ -712,26 +4307,37 @@ void editorDrawStatusBar(struct abuf *ab) {
 
   char status[80], rstatus[80];
   /* show file name and total rows */
-  int len = snprintf(status, sizeof(status), "%20s - %d lines %s",
-                     E.filename ? E.filename : "[No Name]", E.numrows, E.dirty ? "(modified)" : "");
+  int len = snprintf(status, sizeof(status), "%20s - %zd lines %s%s%s",
+                     E.filename ? E.filename : "[No Name]", E.numrows,
+                     E.dirty ? "(modified) " : "", E.follow ? "(following) " : "",
+                     E.wrap ? "(wrap)" : "");
 
   /* show current row / total rows */
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);
+  int rlen;
+  if (E.perfshow)
+    rlen = snprintf(rstatus, sizeof(rstatus), "p50 %.2f p99 %.2f ms %ld B/f",
+                    histPercentile(&E.perf[PERF_FRAME], 50) / 1e6,
+                    histPercentile(&E.perf[PERF_FRAME], 99) / 1e6,
+                    E.frames ? E.totalbytes / E.frames : 0);
+  else if (E.findquery && E.finderr)
+    rlen = snprintf(rstatus, sizeof(rstatus), "bad regex: %s", E.finderr);
+  else if (E.findquery && E.findcount >= 0)
+    rlen = snprintf(rstatus, sizeof(rstatus), "%ld matches | %zd/%zd",
+                    E.findcount, E.cy + 1, E.numrows);
+  else
+    rlen = snprintf(rstatus, sizeof(rstatus), "%zd/%zd", E.cy + 1, E.numrows);
 
   if (len > E.screencols) len = E.screencols;
 
   abAppend(ab, status, len);
-  while (len < E.screencols) {
-    if (E.screencols - len == rlen) {
-      abAppend(ab, rstatus, rlen);
-      break;
-    } else {
-      abAppend(ab, " ", 1);
-      len++;
-    }
+  // pad with spaces and right align rstatus if it fits
+  if (E.screencols - len >= rlen) {
+    abAppendFill(ab, ' ', E.screencols - len - rlen);
+    abAppend(ab, rstatus, rlen);
+  } else {
+    abAppendFill(ab, ' ', E.screencols - len);
   }
   abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\r\n", 2);
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
@@ -744,31 +4350,72 @@ void editorDrawMessageBar(struct abuf *ab) {
 }
 
 
+/* forget what is on screen so the next refresh redraws every line */
+void editorInvalidateScreen() {
+  E.fullredraw = 1;
+}
+
 void editorRefreshScreen() {
+  uint64_t t = histNow();
+  editorPerfEnd(&E.perfkey, PERF_PROCESS, t);
+  editorCheckResize();
   editorScroll();
-  struct abuf ab = ABUF_INIT;
+  t = editorPerfLap(PERF_SCROLL, t);
+  // screen rows plus status bar and message bar
+  int lines = E.screenrows + 2;
+  if (E.shadowrows != lines) {
+    for (int y = 0; y < E.shadowrows; y++)
+      abFree(&E.shadow[y]);
+    E.shadow = realloc(E.shadow, sizeof(struct abuf) * lines);
+    if (E.shadow == NULL)
+      die("realloc");
+    for (int y = 0; y < lines; y++)
+      E.shadow[y] = (struct abuf)ABUF_INIT;
+    E.shadowrows = lines;
+    E.fullredraw = 1;
+  }
+
+  // the frame buffer is kept across refreshes, only its length is reset
+  struct abuf *ab = &E.frame;
   // hide cursor
-  abAppend(&ab, "\x1b[?25l", 6);
-  abAppend(&ab, "\x1b[H", 3);
+  abAppend(ab, "\x1b[?25l", 6);
 
-  editorDrawRows(&ab);
-  editorDrawStatusBar(&ab);
-  editorDrawMessageBar(&ab);
+  editorDrawRows(ab);
+
+  E.line.len = 0;
+  editorDrawStatusBar(&E.line);
+  editorEmitLine(ab, E.screenrows, &E.line);
+  E.line.len = 0;
+  editorDrawMessageBar(&E.line);
+  editorEmitLine(ab, E.screenrows + 1, &E.line);
+  E.fullredraw = 0;
 
   // set cursor position
-  char buf[32];
+  char buf[48];
   // Position cursor using ANSI escape sequence \x1b[row;colH
   // Subtract row/col offsets to handle scrolling - when text is scrolled,
   // we need to adjust the actual cursor position relative to the visible window
   // Add 1 since terminal uses 1-based indexing for cursor positions
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-  abAppend(&ab, buf, strlen(buf));
+  if (E.panelrows)
+    snprintf(buf, sizeof(buf), "\x1b[%zd;1H", (E.panelsel - E.paneloff) + 1);
+  else if (E.wrap)
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.wrapy + 1, E.wrapx + 1);
+  else
+    snprintf(buf, sizeof(buf), "\x1b[%zd;%zdH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+  abAppend(ab, buf, strlen(buf));
 
 
   // show cursor
-  abAppend(&ab, "\x1b[?25h", 6);
-  write(STDOUT_FILENO, ab.b, ab.len);
-  abFree(&ab);
+  abAppend(ab, "\x1b[?25h", 6);
+  t = editorPerfLap(PERF_DRAW, t);
+  ssize_t written = editorFlushFrame(STDOUT_FILENO);
+  t = editorPerfLap(PERF_WRITE, t);
+  editorPerfEnd(&E.perfframe, PERF_FRAME, t);
+  histRecord(&E.perf[PERF_BYTES], written);
+  // bytes sent to the terminal, to see what the line diffing saves
+  E.framebytes = written;
+  E.totalbytes += written;
+  E.frames++;
 }
 
 /* var args */
@@ -790,33 +4437,194 @@ void initEditor() {
   E.numrows = 0;
   E.rowoff = 0;
   E.coloff = 0;
+  E.wrap = 0;
+  E.wrapoff = 0;
+  E.wraplines = (Fenwick){NULL, 0, 0};
+  E.wrapcols = 0;
+  E.wrapy = E.wrapx = 0;
   E.row = NULL;
+  E.rowcap = 0;
+  E.arena = NULL;
+  E.map = NULL;
+  E.mapsize = 0;
+  E.maprows = 0;
+  E.lineidx = NULL;
+  E.mapstale = 0;
+  E.blockloaded = NULL;
   E.filename = NULL;
+  E.filesize = -1;
+  E.follow = 0;
+  E.followfd = -1;
+  memset(&E.filestat, 0, sizeof(E.filestat));
+  E.hashes = NULL;
+  E.nhashes = 0;
+  E.hashcap = 0;
+  E.changed = 0;
+  E.clobber = 0;
+  E.watchfd = -1;
+  E.fileready = 0;
+  E.followpartial = 0;
+  E.filetime = 0;
+  E.save = NULL;
+  E.retired = NULL;
+  E.nretired = 0;
+  E.retiredcap = 0;
+  E.frame = (struct abuf)ABUF_INIT;
+  E.line = (struct abuf)ABUF_INIT;
+  E.pieces = NULL;
+  E.npieces = 0;
+  E.piececap = 0;
+  E.framemark = 0;
+  E.shadow = NULL;
+  E.shadowrows = 0;
+  E.fullredraw = 1;
+  E.framebytes = 0;
+  E.totalbytes = 0;
+  E.frames = 0;
+  memset(E.perf, 0, sizeof(E.perf));
+  E.perfframe = 0;
+  E.perfkey = 0;
+  E.perfshow = 0;
+  E.inlen = 0;
+  E.inpos = 0;
+  E.paste = (struct abuf)ABUF_INIT;
+  E.findquery = NULL;
+  E.findlen = 0;
+  E.findrow = -1;
+  E.findcount = -1;
+  E.findisregex = 0;
+  E.findregex = NULL;
+  E.finderr = NULL;
+  E.syntax = NULL;
+  E.hlvalid = 0;
+  E.undolog = NULL;
+  E.undo = NULL;
+  E.nundo = 0;
+  E.undocap = 0;
+  E.undopos = 0;
+  E.undoopen = 0;
+  E.replaying = 0;
+  E.undobytes = 0;
+  E.pool = NULL;
+  E.panelrows = NULL;
+  E.panelcount = 0;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
   E.logger = createLogger();
   if (!E.logger || !(E.logger->logfile)) die("createLogger");
-  if (getWindowSize(&E.screenrows, &E.screencols) == -1)
-    die("getWindowSize");
+  if (E.term) {
+    E.screenrows = E.term->rows;
+    E.screencols = E.term->cols;
+  } else {
+    if (getWindowSize(&E.screenrows, &E.screencols) == -1)
+      die("getWindowSize");
+    // no SA_RESTART, so a resize wakes up the poll for input
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleWinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+  }
   E.screenrows -= 2; // saving two lines for status bar and message.
 }
 
 
-int main(int argc, char *argv[]) {
-  enableRawMode();
+/*** headless ***/
+/*
+  Run the editor without a tty: frames are drawn into term and keys come
+  only from editorStep. Replaces initEditor.
+ */
+void editorHeadless(VTerm *term) {
+  E.term = term;
   initEditor();
-  if (argc >= 2) {
-    editorOpen(argv[1]);
+}
+
+/* append every key read from the tty to fp, one replay script line per read */
+void editorRecordTo(FILE *fp) {
+  E.record = fp;
+}
+
+void editorRecordKeys(const char *keys, int len) {
+  fputs("1 ", E.record);
+  for (int i = 0; i < len; i++) {
+    unsigned char c = keys[i];
+    if (c == '\\')
+      fputs("\\\\", E.record);
+    else if (c == '\x1b')
+      fputs("\\e", E.record);
+    else if (c == '\r')
+      fputs("\\r", E.record);
+    else if (c == '\n')
+      fputs("\\n", E.record);
+    else if (c == '\t')
+      fputs("\\t", E.record);
+    else if (c < ' ' || c == 0x7f)
+      fprintf(E.record, "\\x%02x", c);
+    else
+      fputc(c, E.record);
   }
+  fputc('\n', E.record);
+  fflush(E.record);
+}
 
-  char c;
-  editorSetStatusMessage("Help: Ctrl-Q = quit");
-  while (1) {
-    editorRefreshScreen();
-    editorProcessKeypress();
-    flush(E.logger);
+/*
+  Decode the keys of a replay script line "<count> <keys>" into out, which
+  has room for as many bytes as line. Keys use the escapes \\ \e \r \n \t
+  and \xHH. Returns the number of bytes and sets *count, or -1 for a
+  comment or blank line.
+ */
+int editorParseScriptLine(const char *line, char *out, int *count) {
+  while (*line == ' ' || *line == '\t')
+    line++;
+  if (*line == '#' || *line == '\n' || *line == '\0')
+    return -1;
+  char *end;
+  *count = (int)strtol(line, &end, 10);
+  if (end == line || *count < 0)
+    return -1;
+  if (*end == ' ')
+    end++;
+  int len = 0;
+  for (const char *p = end; *p && *p != '\n'; p++) {
+    if (*p != '\\' || p[1] == '\0' || p[1] == '\n') {
+      out[len++] = *p;
+      continue;
+    }
+    p++;
+    if (*p == 'e')
+      out[len++] = '\x1b';
+    else if (*p == 'r')
+      out[len++] = '\r';
+    else if (*p == 'n')
+      out[len++] = '\n';
+    else if (*p == 't')
+      out[len++] = '\t';
+    else if (*p == 'x' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+      char hex[3] = {p[1], p[2], '\0'};
+      out[len++] = (char)strtol(hex, NULL, 16);
+      p += 2;
+    } else
+      out[len++] = *p;
   }
-  flush(E.logger);
-  stop(E.logger);
-  return 0;
+  return len;
+}
+
+/*
+  One frame of a headless editor: apply keys the way the main loop applies
+  the keys of one read, then draw. Returns 0 once ^Q has quit.
+ */
+int editorStep(const char *keys, int len) {
+  E.feed = keys;
+  E.feedlen = len;
+  while (editorKeyPending() && !E.quit)
+    editorProcessKeypress();
+  E.feed = NULL;
+  E.feedlen = 0;
+  if (E.quit)
+    return 0;
+  editorSaveCheck(0);
+  editorFollowCheck();
+  editorChangeCheck();
+  editorRefreshScreen();
+  return 1;
 }
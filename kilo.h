@@ -0,0 +1,31 @@
+#ifndef KILO_H
+#define KILO_H
+#include <stdio.h>
+#include "vterm.h"
+
+/*
+  The editor core that main.c drives, also linked by the benchmarks as
+  libkilo.a. All state lives in one global editor, so only one file can
+  be open per process.
+ */
+void enableRawMode();
+void initEditor();
+void editorOpen(char *filename);
+void editorSetStatusMessage(const char *fmt, ...);
+void editorSaveCheck(int wait);
+void editorSetFollow(int on);
+void editorFollowCheck();
+void editorChangeCheck();
+void editorRefreshScreen();
+void editorProcessKeypress();
+int editorKeyPending();
+void editorSetPerfDump(char *filename);
+void editorPerfDump();
+
+/* headless mode, see editorHeadless in kilo.c */
+void editorHeadless(VTerm *term);
+int editorStep(const char *keys, int len);
+void editorRecordTo(FILE *fp);
+void editorRecordKeys(const char *keys, int len);
+int editorParseScriptLine(const char *line, char *out, int *count);
+#endif
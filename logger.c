@@ -1,66 +1,214 @@
+#define _DEFAULT_SOURCE
 #import "logger.h"
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef CLOCK_REALTIME_COARSE
+#define LOG_CLOCK CLOCK_REALTIME_COARSE // the tick's time, read without a syscall
+#else
+#define LOG_CLOCK CLOCK_REALTIME
+#endif
+
+static const char *levelNames[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+static void *writerThread(void *arg);
 
 Logger* createLogger() {
-  Logger *logger = (Logger*)malloc(sizeof(Logger));
+  Logger *logger = (Logger*)calloc(1, sizeof(Logger));
+  if (!logger) return NULL;
   time_t current_time = time(NULL);
   char filename[100];
-  snprintf(filename, sizeof(filename), "Kilo-%ld.log", current_time);
+  // the pid keeps editors started in the same second apart
+  snprintf(filename, sizeof(filename), "Kilo-%ld-%d.log", current_time, (int)getpid());
   logger->logfile = fopen(filename, "wx");
+  if (!logger->logfile) return logger;
+
+  logger->ring = (LogRecord*)malloc(sizeof(LogRecord) * LOG_RING_SIZE);
+  if (!logger->ring) {
+    fclose(logger->logfile);
+    logger->logfile = NULL;
+    return logger;
+  }
+  // every slot starts free for the pass through the ring that uses it
+  for (size_t i = 0; i < LOG_RING_SIZE; i++)
+    logger->ring[i].seq = i;
+  // KILO_LOG_LEVEL=debug|info|warning|error picks the level at startup
+  logger->level = LOG_INFO;
+  const char *env = getenv("KILO_LOG_LEVEL");
+  for (int i = LOG_DEBUG; env && i <= LOG_ERROR; i++) {
+    if (strcasecmp(env, levelNames[i]) == 0)
+      logger->level = (LogLevel)i;
+  }
+  logger->running = 1;
+  pthread_mutex_init(&logger->lock, NULL);
+  pthread_cond_init(&logger->wake, NULL);
+  if (pthread_create(&logger->writer, NULL, writerThread, logger) != 0) {
+    fclose(logger->logfile);
+    logger->logfile = NULL;
+  }
   return logger;
 }
 
-char* get_date() {
-    time_t now;
-    time(&now);
-    char *date = ctime(&now);
-    date[strlen(date) - 1] = '\0'; // Remove newline
-    return date;
+void setLogLevel(Logger *logger, LogLevel level) {
+  if (!logger) return;
+  __atomic_store_n(&logger->level, level, __ATOMIC_RELAXED);
+}
+
+unsigned long droppedMessages(Logger *logger) {
+  if (!logger) return 0;
+  return __atomic_load_n(&logger->dropped, __ATOMIC_RELAXED);
+}
+
+static void logv(Logger *logger, LogLevel level, const char *fmt, va_list args) {
+  if (!logger || !logger->logfile) return;
+  if (level < __atomic_load_n(&logger->level, __ATOMIC_RELAXED)) return;
+
+  /*
+    Claim a slot: it is free when its seq equals our position. If the
+    writer hasn't caught up the ring is full and the record is dropped
+    rather than making the caller wait.
+   */
+  size_t pos = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+  LogRecord *rec;
+  while (1) {
+    rec = &logger->ring[pos & (LOG_RING_SIZE - 1)];
+    size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&logger->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      __atomic_add_fetch(&logger->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+    }
+  }
+  struct timespec ts;
+  clock_gettime(LOG_CLOCK, &ts);
+  rec->level = level;
+  rec->time = ts.tv_sec;
+  vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+  /*
+    Publish the record to the writer, and wake it if it went to sleep on
+    an empty ring. It only sleeps once it has written everything, so the
+    lock is taken once per batch, not per record. Both sides store their
+    flag before looking at the other's, so one of them always sees it.
+   */
+  __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&logger->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&logger->lock);
+    __atomic_store_n(&logger->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&logger->wake);
+    pthread_mutex_unlock(&logger->lock);
+  }
 }
 
+void logMessage(Logger *logger, LogLevel level, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  logv(logger, level, fmt, args);
+  va_end(args);
+}
 
 void info(Logger *logger, const char *fmt, ...) {
-    if (!logger || !logger->logfile) return;    
-    fprintf(logger->logfile, "[%s] [INFO] ", get_date());
-   
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(logger->logfile, fmt, args);
-    va_end(args);
-    
-    fprintf(logger->logfile, "\n");
+  va_list args;
+  va_start(args, fmt);
+  logv(logger, LOG_INFO, fmt, args);
+  va_end(args);
 }
 
 void error(Logger *logger, const char *fmt, ...) {
-    if (!logger || !logger->logfile) return;
-    fprintf(logger->logfile, "[%s] [ERROR] ", get_date());
-    
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(logger->logfile, fmt, args);
-    va_end(args);
-    
-    fprintf(logger->logfile, "\n");
+  va_list args;
+  va_start(args, fmt);
+  logv(logger, LOG_ERROR, fmt, args);
+  va_end(args);
 }
 
 void warning(Logger *logger, const char *fmt, ...) {
-    if (!logger || !logger->logfile) return;
-    fprintf(logger->logfile, "[%s] [WARNING] ", get_date());
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(logger->logfile, fmt, args);
-    va_end(args);
-    
-    fprintf(logger->logfile, "\n");
+  va_list args;
+  va_start(args, fmt);
+  logv(logger, LOG_WARNING, fmt, args);
+  va_end(args);
+}
+
+/* write every published record to the file, returns how many there were */
+static int drain(Logger *logger) {
+  static time_t datetime = -1;
+  static char date[32];
+  static unsigned long reported = 0;
+  int n = 0;
+  while (1) {
+    LogRecord *rec = &logger->ring[logger->tail & (LOG_RING_SIZE - 1)];
+    size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    if (seq != logger->tail + 1)
+      break;
+    // the date string only changes once a second
+    if (rec->time != datetime) {
+      struct tm tm;
+      localtime_r(&rec->time, &tm);
+      strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", &tm);
+      datetime = rec->time;
+    }
+    fprintf(logger->logfile, "[%s] [%s] %s\n", date, levelNames[rec->level], rec->msg);
+    // hand the slot back for the next pass through the ring
+    __atomic_store_n(&rec->seq, logger->tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    logger->tail++;
+    n++;
+  }
+  unsigned long dropped = droppedMessages(logger);
+  if (dropped != reported) {
+    fprintf(logger->logfile, "[%s] [WARNING] %lu log messages dropped\n",
+            date, dropped - reported);
+    reported = dropped;
+  }
+  if (n)
+    fflush(logger->logfile);
+  return n;
+}
+
+/* the next record to write has been published */
+static int pending(Logger *logger) {
+  LogRecord *rec = &logger->ring[logger->tail & (LOG_RING_SIZE - 1)];
+  return __atomic_load_n(&rec->seq, __ATOMIC_SEQ_CST) == logger->tail + 1;
+}
+
+static void *writerThread(void *arg) {
+  Logger *logger = (Logger*)arg;
+  pthread_mutex_lock(&logger->lock);
+  while (logger->running) {
+    pthread_mutex_unlock(&logger->lock);
+    drain(logger);
+    pthread_mutex_lock(&logger->lock);
+    // sleep without a timeout until a caller logs, flushes or stops
+    __atomic_store_n(&logger->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (logger->running && logger->sleeping && !pending(logger))
+      pthread_cond_wait(&logger->wake, &logger->lock);
+    __atomic_store_n(&logger->sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&logger->lock);
+  drain(logger);
+  return NULL;
 }
 
+/* ask the writer to write out what is queued, doesn't wait for it */
 void flush(Logger *logger) {
-  if (!logger || !logger->logfile) return;   
-  fflush(logger->logfile);
+  if (!logger || !logger->logfile) return;
+  pthread_mutex_lock(&logger->lock);
+  pthread_cond_signal(&logger->wake);
+  pthread_mutex_unlock(&logger->lock);
 }
 
 void stop(Logger *logger) {
-  if (!logger || !logger->logfile) return;   
+  if (!logger || !logger->logfile) return;
+  pthread_mutex_lock(&logger->lock);
+  logger->running = 0;
+  pthread_cond_signal(&logger->wake);
+  pthread_mutex_unlock(&logger->lock);
+  pthread_join(logger->writer, NULL);
   fclose(logger->logfile);
+  free(logger->ring);
   free(logger);
 }
@@ -4,15 +4,66 @@
 #import <stdlib.h>
 #include <time.h>
 #include <stdarg.h>  // Added for variable arguments
+#include <pthread.h>
 
+/*
+  Set LOGGER_DEBUG to 1 at compile time to keep debug() calls, otherwise
+  they compile to nothing and cost nothing on hot paths.
+ */
+#ifndef LOGGER_DEBUG
+#define LOGGER_DEBUG 0
+#endif
+
+#define LOG_RING_SIZE 4096 // records in the ring, must be a power of two
+#define LOG_MSG_SIZE 240 // longer messages are truncated
+
+typedef enum {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARNING,
+  LOG_ERROR
+} LogLevel;
+
+/* one log call, formatted by the caller and written out by the writer thread */
+typedef struct {
+  size_t seq; // ring sequence number, tells whether the slot is free or full
+  LogLevel level;
+  time_t time;
+  char msg[LOG_MSG_SIZE];
+} LogRecord;
+
+/*
+  Calls only format their message into a lock-free ring buffer. A writer
+  thread drains the ring in batches, so no file I/O happens on the
+  caller's thread.
+ */
 typedef struct {
   FILE *logfile;
+  LogRecord *ring;
+  size_t head; // next slot to fill, shared by all callers
+  size_t tail; // next slot to write, only used by the writer thread
+  LogLevel level; // records below this level are dropped at the call site
+  unsigned long dropped; // records lost because the ring was full
+  int running;
+  int sleeping; // the writer waits for wake, the next record has to signal it
+  pthread_t writer;
+  pthread_mutex_t lock; // only guards wakeup of the writer
+  pthread_cond_t wake;
 } Logger;
 
 Logger* createLogger();
+void setLogLevel(Logger *logger, LogLevel level);
+unsigned long droppedMessages(Logger *logger);
+void logMessage(Logger *logger, LogLevel level, const char *fmt, ...);
 void info(Logger *logger, const char *fmt, ...);
 void error(Logger *logger, const char *fmt, ...);
 void warning(Logger *logger, const char *fmt, ...);
 void flush(Logger *logger);
 void stop(Logger *logger);
+
+#if LOGGER_DEBUG
+#define debug(logger, ...) logMessage(logger, LOG_DEBUG, __VA_ARGS__)
+#else
+#define debug(logger, ...) ((void)(logger))
+#endif
 #endif
@@ -0,0 +1,154 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kilo.h"
+
+#define REPLAY_ROWS 24
+#define REPLAY_COLS 80
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+  Run a replay script against filename in an in-memory terminal, then print
+  the final screen to stdout and the frame times to stderr.
+ */
+static int replay(const char *script, char *filename) {
+  FILE *fp = fopen(script, "r");
+  if (!fp) {
+    perror(script);
+    return 1;
+  }
+  VTerm *term = createVTerm(REPLAY_ROWS, REPLAY_COLS);
+  if (!term) {
+    perror("createVTerm");
+    return 1;
+  }
+  editorHeadless(term);
+  double start = now();
+  if (filename)
+    editorOpen(filename);
+  double load = now() - start;
+  editorStep(NULL, 0);
+
+  double *times = NULL;
+  int ntimes = 0, cap = 0;
+  char *line = NULL, *keys = NULL;
+  size_t linecap = 0, keyscap = 0;
+  ssize_t linelen;
+  int running = 1;
+  while (running && (linelen = getline(&line, &linecap, fp)) != -1) {
+    if (keyscap < linecap) {
+      keyscap = linecap;
+      keys = realloc(keys, keyscap);
+    }
+    int count;
+    int len = editorParseScriptLine(line, keys, &count);
+    for (int i = 0; len >= 0 && i < count && running; i++) {
+      if (ntimes == cap) {
+        cap = cap ? cap * 2 : 256;
+        times = realloc(times, sizeof(double) * cap);
+      }
+      double t = now();
+      running = editorStep(keys, len);
+      times[ntimes++] = now() - t;
+    }
+  }
+  fclose(fp);
+  free(line);
+  free(keys);
+
+  char buf[REPLAY_COLS * 4 + 1];
+  for (int y = 0; y < term->rows; y++) {
+    vtermLine(term, y, buf, sizeof(buf));
+    printf("%s\n", buf);
+  }
+  qsort(times, ntimes, sizeof(double), cmpDouble);
+  fprintf(stderr, "load %.3f ms, %d frames", load * 1e3, ntimes);
+  if (ntimes > 0)
+    fprintf(stderr, ", p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+            times[ntimes / 2] * 1e3, times[ntimes * 99 / 100] * 1e3,
+            times[ntimes - 1] * 1e3);
+  fprintf(stderr, ", %zu bytes drawn\n", term->bytes);
+  free(times);
+  editorPerfDump();
+  return 0;
+}
+
+static void usage(const char *prog, int status) {
+  FILE *fp = status ? stderr : stdout;
+  fprintf(fp, "usage: %s [--record script | --replay script] [--perf-dump file] [--follow] [--help] [file]\n", prog);
+  fprintf(fp, "\nkeys:\n"
+              "  ^S save          ^Q quit\n"
+              "  ^F find          ^R find a regex     ^G list matching lines\n"
+              "  ^N go to line    ^Z undo             ^Y redo\n"
+              "  ^W wrap lines    ^T follow the file  ^P frame times\n");
+  exit(status);
+}
+
+int main(int argc, char *argv[]) {
+  char *script = NULL;
+  int replaying = 0;
+  int follow = 0;
+  int i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    if (strcmp(argv[i], "--follow") == 0) {
+      follow = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "--help") == 0)
+      usage(argv[0], 0);
+    if (i + 1 >= argc)
+      usage(argv[0], 1);
+    if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+      script = argv[i + 1];
+      replaying = strcmp(argv[i], "--replay") == 0;
+    } else if (strcmp(argv[i], "--perf-dump") == 0) {
+      // the histograms are written when the editor quits
+      editorSetPerfDump(argv[i + 1]);
+    } else
+      usage(argv[0], 1);
+    i++;
+  }
+  char *filename = i < argc ? argv[i] : NULL;
+  if (replaying)
+    return replay(script, filename);
+  if (script) {
+    FILE *fp = fopen(script, "w");
+    if (!fp) {
+      perror(script);
+      return 1;
+    }
+    editorRecordTo(fp);
+  }
+  enableRawMode();
+  initEditor();
+  if (filename) {
+    editorOpen(filename);
+    if (follow)
+      editorSetFollow(1);
+  }
+
+  editorSetStatusMessage("Help: ^S save | ^Q quit | ^F find | ^N go to line | --help for all keys");
+  while (1) {
+    editorSaveCheck(0);
+    editorFollowCheck();
+    editorChangeCheck();
+    editorRefreshScreen();
+    // apply every key that has arrived before drawing again
+    do {
+      editorProcessKeypress();
+    } while (editorKeyPending());
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+#define _DEFAULT_SOURCE
+#include "pool.h"
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+static void *worker(void *arg) {
+  ThreadPool *pool = (ThreadPool*)arg;
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (!pool->stopping && pool->next >= pool->ntasks)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if (pool->stopping)
+      break;
+    int task = pool->next++;
+    PoolTask fn = pool->fn;
+    void *ctx = pool->ctx;
+    pthread_mutex_unlock(&pool->lock);
+    fn(ctx, task);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+      pthread_cond_broadcast(&pool->idle);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+ThreadPool* createPool(int nthreads) {
+  ThreadPool *pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+  if (!pool) return NULL;
+  if (nthreads < 1) nthreads = 1;
+  pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+  if (!pool->threads) {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+      break;
+    pool->nthreads++;
+  }
+  if (pool->nthreads == 0) {
+    destroyPool(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void poolSubmit(ThreadPool *pool, PoolTask fn, void *ctx, int ntasks) {
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->ntasks = ntasks;
+  pool->next = 0;
+  pool->pending = ntasks;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+  Wait up to timeout_ms (-1 forever) for the current batch. Returns 1 when
+  every task has finished, 0 on timeout.
+ */
+int poolWait(ThreadPool *pool, int timeout_ms) {
+  struct timespec ts;
+  if (timeout_ms >= 0) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+  }
+  pthread_mutex_lock(&pool->lock);
+  int rc = 0;
+  while (pool->pending > 0 && rc != ETIMEDOUT) {
+    if (timeout_ms >= 0)
+      rc = pthread_cond_timedwait(&pool->idle, &pool->lock, &ts);
+    else
+      pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  int done = pool->pending == 0;
+  pthread_mutex_unlock(&pool->lock);
+  return done;
+}
+
+void destroyPool(ThreadPool *pool) {
+  if (!pool) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->nthreads; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool->threads);
+  free(pool);
+}
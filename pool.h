@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+#include <pthread.h>
+
+/*
+  Fixed set of worker threads that run numbered tasks. poolSubmit hands
+  out tasks 0..ntasks-1 to the workers, which claim them one at a time, so
+  uneven tasks still balance out. Only one batch runs at a time.
+ */
+typedef void (*PoolTask)(void *ctx, int task);
+
+typedef struct {
+  pthread_t *threads;
+  int nthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t work; // a batch was submitted or the pool is stopping
+  pthread_cond_t idle; // a batch finished
+  PoolTask fn;
+  void *ctx;
+  int ntasks;
+  int next; // next task to hand out
+  int pending; // tasks not finished yet
+  int stopping;
+} ThreadPool;
+
+ThreadPool* createPool(int nthreads);
+void poolSubmit(ThreadPool *pool, PoolTask fn, void *ctx, int ntasks);
+int poolWait(ThreadPool *pool, int timeout_ms);
+void destroyPool(ThreadPool *pool);
+#endif
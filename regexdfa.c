@@ -0,0 +1,683 @@
+#include "regexdfa.h"
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REGEX_MAX_STATES 2048 // DFA states cached before the cache is flushed
+#define REGEX_HASH_SIZE 4096
+#define REGEX_MAX_REPEAT 1000 // largest count allowed in {n,m}
+#define REGEX_MAX_NFA 10000 // NFA states a pattern may expand to
+
+/*** parser: pattern -> syntax tree ***/
+
+enum { N_SET, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_REPEAT, N_EMPTY, N_BOL, N_EOL };
+
+typedef struct Node {
+  int type;
+  struct Node *left, *right;
+  int set; // index into the set table for N_SET
+  int min, max; // for N_REPEAT, max -1 is unbounded
+} Node;
+
+typedef unsigned char ByteSet[32];
+
+typedef struct {
+  const char *p;
+  const char *err;
+  Node *nodes;
+  int nnodes, nodecap;
+  ByteSet *sets;
+  int nsets, setcap;
+} Parser;
+
+static Node *newNode(Parser *ps, int type, Node *left, Node *right) {
+  if (ps->nnodes == ps->nodecap) {
+    ps->err = "pattern too complex";
+    return NULL;
+  }
+  Node *n = &ps->nodes[ps->nnodes++];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+static int newSet(Parser *ps) {
+  if (ps->nsets == ps->setcap) {
+    int cap = ps->setcap ? ps->setcap * 2 : 16;
+    ByteSet *new = realloc(ps->sets, sizeof(ByteSet) * cap);
+    if (!new) {
+      ps->err = "out of memory";
+      return -1;
+    }
+    ps->sets = new;
+    ps->setcap = cap;
+  }
+  memset(ps->sets[ps->nsets], 0, sizeof(ByteSet));
+  return ps->nsets++;
+}
+
+#define SET_ADD(s, c) ((s)[(unsigned char)(c) >> 3] |= 1 << ((unsigned char)(c) & 7))
+#define SET_HAS(s, c) ((s)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+/* add the class of a \d \w \s style escape to s, returns 0 if c isn't one */
+static int addClass(unsigned char *s, char c) {
+  ByteSet tmp;
+  memset(tmp, 0, sizeof(tmp));
+  int neg = 0;
+  switch (c) {
+  case 'D': neg = 1; /* fall through */
+  case 'd':
+    for (int i = '0'; i <= '9'; i++) SET_ADD(tmp, i);
+    break;
+  case 'W': neg = 1; /* fall through */
+  case 'w':
+    for (int i = 0; i < 256; i++)
+      if ((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') ||
+          (i >= '0' && i <= '9') || i == '_')
+        SET_ADD(tmp, i);
+    break;
+  case 'S': neg = 1; /* fall through */
+  case 's':
+    SET_ADD(tmp, ' '); SET_ADD(tmp, '\t'); SET_ADD(tmp, '\r');
+    SET_ADD(tmp, '\n'); SET_ADD(tmp, '\f'); SET_ADD(tmp, '\v');
+    break;
+  default:
+    return 0;
+  }
+  for (int i = 0; i < 32; i++)
+    s[i] |= neg ? ~tmp[i] : tmp[i];
+  return 1;
+}
+
+static char escapeChar(char c) {
+  switch (c) {
+  case 'n': return '\n';
+  case 't': return '\t';
+  case 'r': return '\r';
+  case 'f': return '\f';
+  case 'v': return '\v';
+  default: return c;
+  }
+}
+
+static Node *parseAlt(Parser *ps);
+
+static Node *parseClass(Parser *ps) {
+  int set = newSet(ps);
+  if (set == -1) return NULL;
+  ByteSet s;
+  memset(s, 0, sizeof(s));
+  int neg = 0;
+  if (*ps->p == '^') {
+    neg = 1;
+    ps->p++;
+  }
+  int first = 1;
+  while (*ps->p && (*ps->p != ']' || first)) {
+    first = 0;
+    unsigned char lo = *ps->p++;
+    if (lo == '\\' && *ps->p) {
+      if (addClass(s, *ps->p)) {
+        ps->p++;
+        continue;
+      }
+      lo = escapeChar(*ps->p++);
+    }
+    unsigned char hi = lo;
+    if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+      ps->p++;
+      hi = *ps->p++;
+      if (hi == '\\' && *ps->p)
+        hi = escapeChar(*ps->p++);
+      if (hi < lo) {
+        ps->err = "bad range in []";
+        return NULL;
+      }
+    }
+    for (int c = lo; c <= hi; c++) SET_ADD(s, c);
+  }
+  if (*ps->p != ']') {
+    ps->err = "missing ]";
+    return NULL;
+  }
+  ps->p++;
+  for (int i = 0; i < 32; i++)
+    ps->sets[set][i] = neg ? ~s[i] : s[i];
+  Node *n = newNode(ps, N_SET, NULL, NULL);
+  if (n) n->set = set;
+  return n;
+}
+
+static Node *parseAtom(Parser *ps) {
+  char c = *ps->p;
+  if (c == '(') {
+    ps->p++;
+    Node *n = parseAlt(ps);
+    if (!n) return NULL;
+    if (*ps->p != ')') {
+      ps->err = "missing )";
+      return NULL;
+    }
+    ps->p++;
+    return n;
+  }
+  if (c == '[') {
+    ps->p++;
+    return parseClass(ps);
+  }
+  if (c == '^' || c == '$') {
+    ps->p++;
+    return newNode(ps, c == '^' ? N_BOL : N_EOL, NULL, NULL);
+  }
+  if (c == '*' || c == '+' || c == '?' || c == '{') {
+    ps->err = "nothing to repeat";
+    return NULL;
+  }
+  int set = newSet(ps);
+  if (set == -1) return NULL;
+  ps->p++;
+  if (c == '.') {
+    for (int i = 0; i < 256; i++)
+      if (i != '\n') SET_ADD(ps->sets[set], i);
+  } else if (c == '\\') {
+    if (!*ps->p) {
+      ps->err = "trailing \\";
+      return NULL;
+    }
+    char e = *ps->p++;
+    if (!addClass(ps->sets[set], e))
+      SET_ADD(ps->sets[set], escapeChar(e));
+  } else {
+    SET_ADD(ps->sets[set], c);
+  }
+  Node *n = newNode(ps, N_SET, NULL, NULL);
+  if (n) n->set = set;
+  return n;
+}
+
+static int parseNumber(Parser *ps) {
+  int n = -1;
+  while (*ps->p >= '0' && *ps->p <= '9') {
+    n = (n < 0 ? 0 : n) * 10 + (*ps->p++ - '0');
+    if (n > REGEX_MAX_REPEAT) {
+      ps->err = "repeat count too large";
+      return -1;
+    }
+  }
+  return n;
+}
+
+static Node *parseRepeat(Parser *ps) {
+  Node *n = parseAtom(ps);
+  while (n) {
+    char c = *ps->p;
+    if (c == '*' || c == '+' || c == '?') {
+      ps->p++;
+      n = newNode(ps, c == '*' ? N_STAR : c == '+' ? N_PLUS : N_QUEST, n, NULL);
+    } else if (c == '{') {
+      ps->p++;
+      int min = parseNumber(ps), max = min;
+      if (*ps->p == ',') {
+        ps->p++;
+        max = parseNumber(ps);
+      }
+      if (ps->err) return NULL;
+      if (min < 0 || *ps->p != '}' || (max >= 0 && max < min)) {
+        ps->err = "bad {n,m}";
+        return NULL;
+      }
+      ps->p++;
+      n = newNode(ps, N_REPEAT, n, NULL);
+      if (n) {
+        n->min = min;
+        n->max = max;
+      }
+    } else {
+      break;
+    }
+  }
+  return n;
+}
+
+static Node *parseCat(Parser *ps) {
+  Node *n = newNode(ps, N_EMPTY, NULL, NULL);
+  while (n && *ps->p && *ps->p != '|' && *ps->p != ')') {
+    Node *r = parseRepeat(ps);
+    if (!r) return NULL;
+    n = n->type == N_EMPTY ? r : newNode(ps, N_CAT, n, r);
+  }
+  return n;
+}
+
+static Node *parseAlt(Parser *ps) {
+  Node *n = parseCat(ps);
+  while (n && *ps->p == '|') {
+    ps->p++;
+    Node *r = parseCat(ps);
+    if (!r) return NULL;
+    n = newNode(ps, N_ALT, n, r);
+  }
+  return n;
+}
+
+/*** compiler: syntax tree -> NFA ***/
+
+enum { S_SET, S_SPLIT, S_MATCH, S_BOL, S_EOL };
+
+typedef struct {
+  int type;
+  int set;
+  int out, out1;
+} NState;
+
+typedef struct DState {
+  int *nfa; // sorted NFA states, after following empty transitions
+  int n;
+  int match; // a match ends before the next byte
+  int eolmatch; // a match ends here if this is the end of the row
+  struct DState *next[256]; // NULL until the transition is first taken
+  struct DState *hashnext;
+} DState;
+
+typedef struct {
+  int unanchored; // a new match may start at every byte
+  DState *table[REGEX_HASH_SIZE];
+  int nstates;
+  DState *start[2]; // start states, [1] at the beginning of the row
+} Dfa;
+
+struct Regex {
+  NState *states;
+  int nstates, statecap;
+  ByteSet *sets;
+  int start;
+  char *prefix; // literal every match starts with, used to skip ahead
+  int prefixlen;
+  Dfa anchored, unanchored;
+  // scratch for building state sets, sized by the number of NFA states
+  int *stack, *list, *mark;
+  int gen;
+};
+
+static int addState(Regex *re, int type, int set, int out, int out1) {
+  if (re->nstates == re->statecap) {
+    int cap = re->statecap ? re->statecap * 2 : 64;
+    NState *new = realloc(re->states, sizeof(NState) * cap);
+    if (!new) return -1;
+    re->states = new;
+    re->statecap = cap;
+  }
+  re->states[re->nstates] = (NState){type, set, out, out1};
+  return re->nstates++;
+}
+
+/* compile n so that it continues with state next, returns its first state */
+static int compile(Regex *re, Node *n, int next) {
+  int s, body;
+  if (next < 0) return -1;
+  switch (n->type) {
+  case N_SET:
+    return addState(re, S_SET, n->set, next, -1);
+  case N_EMPTY:
+    return next;
+  case N_BOL:
+    return addState(re, S_BOL, -1, next, -1);
+  case N_EOL:
+    return addState(re, S_EOL, -1, next, -1);
+  case N_CAT:
+    return compile(re, n->left, compile(re, n->right, next));
+  case N_ALT:
+    body = compile(re, n->left, next);
+    s = compile(re, n->right, next);
+    return addState(re, S_SPLIT, -1, body, s);
+  case N_QUEST:
+    body = compile(re, n->left, next);
+    return addState(re, S_SPLIT, -1, body, next);
+  case N_STAR:
+    // the loop state is made first, its body points back at it
+    s = addState(re, S_SPLIT, -1, -1, next);
+    if (s < 0) return -1;
+    body = compile(re, n->left, s);
+    re->states[s].out = body;
+    return s;
+  case N_PLUS:
+    s = addState(re, S_SPLIT, -1, -1, next);
+    if (s < 0) return -1;
+    body = compile(re, n->left, s);
+    re->states[s].out = body;
+    return body;
+  case N_REPEAT: {
+    Node star = {N_STAR, n->left, NULL, 0, 0, 0};
+    Node quest = {N_QUEST, n->left, NULL, 0, 0, 0};
+    s = next;
+    if (n->max < 0) {
+      s = compile(re, &star, s);
+    } else {
+      for (int i = n->min; i < n->max; i++)
+        s = compile(re, &quest, s);
+    }
+    for (int i = 0; i < n->min; i++)
+      s = compile(re, n->left, s);
+    return s;
+  }
+  }
+  return -1;
+}
+
+/*
+  NFA states compile will make for n, stopping at REGEX_MAX_NFA + 1 so
+  nested counts like ((a{1000}){1000}){1000} can't overflow.
+ */
+static long nfaSize(Node *n) {
+  long l = n->left ? nfaSize(n->left) : 0;
+  long size;
+  switch (n->type) {
+  case N_EMPTY:
+    size = 0;
+    break;
+  case N_CAT:
+    size = l + nfaSize(n->right);
+    break;
+  case N_ALT:
+    size = l + nfaSize(n->right) + 1;
+    break;
+  case N_QUEST:
+  case N_STAR:
+  case N_PLUS:
+    size = l + 1;
+    break;
+  case N_REPEAT:
+    size = n->min * l + (n->max < 0 ? l + 1 : (n->max - n->min) * (l + 1));
+    break;
+  default:
+    size = 1;
+  }
+  return size > REGEX_MAX_NFA ? REGEX_MAX_NFA + 1 : size;
+}
+
+/* the literal bytes every match must start with */
+static void findPrefix(Regex *re, Node *n, Parser *ps) {
+  // flatten the leading concatenation
+  Node *items[64];
+  int nitems = 0;
+  while (n && n->type == N_CAT && nitems < 63) {
+    Node *l = n->left;
+    // N_CAT is left-nested: ((a b) c) d
+    items[nitems++] = n->right;
+    n = l;
+  }
+  if (n) items[nitems++] = n;
+  re->prefix = malloc(nitems + 1);
+  if (!re->prefix) return;
+  re->prefixlen = 0;
+  for (int i = nitems - 1; i >= 0; i--) {
+    Node *it = items[i];
+    if (it->type != N_SET) break;
+    int count = 0, byte = 0;
+    for (int c = 0; c < 256 && count < 2; c++) {
+      if (SET_HAS(ps->sets[it->set], c)) {
+        count++;
+        byte = c;
+      }
+    }
+    if (count != 1) break;
+    re->prefix[re->prefixlen++] = byte;
+  }
+}
+
+Regex* regexCompile(const char *pattern, const char **err) {
+  Parser ps = {pattern, NULL, NULL, 0, 0, NULL, 0, 0};
+  // every pattern byte makes at most two nodes
+  ps.nodecap = strlen(pattern) * 2 + 2;
+  ps.nodes = malloc(sizeof(Node) * ps.nodecap);
+  Regex *re = calloc(1, sizeof(Regex));
+  if (!ps.nodes || !re) {
+    free(ps.nodes);
+    free(re);
+    if (err) *err = "out of memory";
+    return NULL;
+  }
+  Node *root = parseAlt(&ps);
+  if (root && *ps.p == ')') ps.err = "unmatched )";
+  if (root && !ps.err && nfaSize(root) > REGEX_MAX_NFA) ps.err = "pattern too large";
+  if (!root || ps.err) {
+    if (err) *err = ps.err ? ps.err : "bad pattern";
+    free(ps.nodes);
+    free(ps.sets);
+    free(re);
+    return NULL;
+  }
+  int match = addState(re, S_MATCH, -1, -1, -1);
+  re->start = compile(re, root, match);
+  re->sets = ps.sets;
+  findPrefix(re, root, &ps);
+  free(ps.nodes);
+  // each state is expanded once and pushes at most two more
+  re->stack = malloc(sizeof(int) * (re->nstates * 3 + 2));
+  re->list = malloc(sizeof(int) * (re->nstates + 1));
+  re->mark = calloc(re->nstates + 1, sizeof(int));
+  if (re->start < 0 || !re->stack || !re->list || !re->mark || !re->prefix) {
+    if (err) *err = "out of memory";
+    regexFree(re);
+    return NULL;
+  }
+  re->unanchored.unanchored = 1;
+  return re;
+}
+
+/*** lazy DFA ***/
+
+static int cmpInt(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+/* push s and everything reachable from it without reading a byte */
+static void closure(Regex *re, int s, int bol, int *n) {
+  int sp = 0;
+  re->stack[sp++] = s;
+  while (sp > 0) {
+    s = re->stack[--sp];
+    if (s < 0 || re->mark[s] == re->gen) continue;
+    re->mark[s] = re->gen;
+    NState *st = &re->states[s];
+    switch (st->type) {
+    case S_SPLIT:
+      re->stack[sp++] = st->out1;
+      re->stack[sp++] = st->out;
+      break;
+    case S_BOL:
+      if (bol) re->stack[sp++] = st->out;
+      break;
+    default:
+      // byte sets, matches and end of row checks stay in the set
+      re->list[(*n)++] = s;
+    }
+  }
+}
+
+/* does following the $ states of a set reach a match */
+static int eolMatch(Regex *re, int *set, int n) {
+  int sp = 0;
+  re->gen++;
+  for (int i = 0; i < n; i++)
+    if (re->states[set[i]].type == S_EOL)
+      re->stack[sp++] = re->states[set[i]].out;
+  while (sp > 0) {
+    int s = re->stack[--sp];
+    if (s < 0 || re->mark[s] == re->gen) continue;
+    re->mark[s] = re->gen;
+    NState *st = &re->states[s];
+    if (st->type == S_MATCH) return 1;
+    if (st->type == S_SPLIT) {
+      re->stack[sp++] = st->out1;
+      re->stack[sp++] = st->out;
+    } else if (st->type == S_EOL) {
+      re->stack[sp++] = st->out;
+    }
+  }
+  return 0;
+}
+
+static unsigned hashSet(int *set, int n) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++)
+    h = (h ^ (unsigned)set[i]) * 16777619u;
+  return h % REGEX_HASH_SIZE;
+}
+
+static void flushDfa(Dfa *dfa) {
+  for (int i = 0; i < REGEX_HASH_SIZE; i++) {
+    DState *d = dfa->table[i];
+    while (d) {
+      DState *next = d->hashnext;
+      free(d->nfa);
+      free(d);
+      d = next;
+    }
+    dfa->table[i] = NULL;
+  }
+  dfa->nstates = 0;
+  dfa->start[0] = dfa->start[1] = NULL;
+}
+
+/* find or create the DFA state for the n NFA states in re->list */
+static DState *cachedState(Regex *re, Dfa *dfa, int n) {
+  qsort(re->list, n, sizeof(int), cmpInt);
+  unsigned h = hashSet(re->list, n);
+  for (DState *d = dfa->table[h]; d; d = d->hashnext) {
+    if (d->n == n && memcmp(d->nfa, re->list, sizeof(int) * n) == 0)
+      return d;
+  }
+  DState *d = calloc(1, sizeof(DState));
+  if (!d) return NULL;
+  d->nfa = malloc(sizeof(int) * (n ? n : 1));
+  if (!d->nfa) {
+    free(d);
+    return NULL;
+  }
+  memcpy(d->nfa, re->list, sizeof(int) * n);
+  d->n = n;
+  for (int i = 0; i < n; i++)
+    if (re->states[d->nfa[i]].type == S_MATCH) d->match = 1;
+  // eolMatch reuses list, d->nfa holds the copy
+  d->eolmatch = d->match || eolMatch(re, d->nfa, n);
+  d->hashnext = dfa->table[h];
+  dfa->table[h] = d;
+  dfa->nstates++;
+  return d;
+}
+
+static DState *startState(Regex *re, Dfa *dfa, int bol) {
+  if (dfa->start[bol]) return dfa->start[bol];
+  re->gen++;
+  int n = 0;
+  closure(re, re->start, bol, &n);
+  dfa->start[bol] = cachedState(re, dfa, n);
+  return dfa->start[bol];
+}
+
+/* the state after reading byte c in state d */
+static DState *step(Regex *re, Dfa *dfa, DState *d, unsigned char c) {
+  if (d->next[c]) return d->next[c];
+  if (dfa->nstates >= REGEX_MAX_STATES) {
+    // cache is full: start over, keeping only the state we are in
+    int n = d->n;
+    int *keep = malloc(sizeof(int) * (n ? n : 1));
+    if (!keep) return NULL;
+    memcpy(keep, d->nfa, sizeof(int) * n);
+    flushDfa(dfa);
+    memcpy(re->list, keep, sizeof(int) * n);
+    free(keep);
+    d = cachedState(re, dfa, n);
+    if (!d) return NULL;
+  }
+  re->gen++;
+  int n = 0;
+  for (int i = 0; i < d->n; i++) {
+    NState *st = &re->states[d->nfa[i]];
+    if (st->type == S_SET && SET_HAS(re->sets[st->set], c))
+      closure(re, st->out, 0, &n);
+  }
+  if (dfa->unanchored)
+    closure(re, re->start, 0, &n);
+  DState *next = cachedState(re, dfa, n);
+  d->next[c] = next;
+  return next;
+}
+
+/*
+  Longest match starting exactly at from. Returns the end of the match,
+  or -1 if none starts there.
+ */
+static long matchAt(Regex *re, const unsigned char *text, size_t len, size_t from) {
+  DState *d = startState(re, &re->anchored, from == 0);
+  long end = -1;
+  for (size_t i = from; d; i++) {
+    if (d->match) end = i;
+    if (i == len) {
+      if (d->eolmatch) end = i;
+      break;
+    }
+    if (d->n == 0) break;
+    d = step(re, &re->anchored, d, text[i]);
+  }
+  return end;
+}
+
+/* end of the earliest ending match at or after from, or -1 */
+static long firstEnd(Regex *re, const unsigned char *text, size_t len, size_t from) {
+  DState *d = startState(re, &re->unanchored, from == 0);
+  for (size_t i = from; d; i++) {
+    if (d->match) return i;
+    if (i == len) return d->eolmatch ? (long)i : -1;
+    d = step(re, &re->unanchored, d, text[i]);
+  }
+  return -1;
+}
+
+int regexSearch(Regex *re, const char *text, size_t len, size_t from,
+                size_t *mstart, size_t *mlen) {
+  const unsigned char *t = (const unsigned char *)text;
+  if (from > len) return 0;
+  if (re->prefixlen > 0) {
+    // every match starts with the prefix: only try where it occurs
+    const char *p = text + from;
+    while ((p = searchMem(p, len - (p - text), re->prefix, re->prefixlen))) {
+      long end = matchAt(re, t, len, p - text);
+      if (end >= 0) {
+        *mstart = p - text;
+        *mlen = end - (p - text);
+        return 1;
+      }
+      p++;
+    }
+    return 0;
+  }
+  long first = firstEnd(re, t, len, from);
+  if (first < 0) return 0;
+  // the leftmost match starts no later than the earliest match ends
+  for (size_t s = from; s <= (size_t)first; s++) {
+    long end = matchAt(re, t, len, s);
+    if (end >= 0) {
+      *mstart = s;
+      *mlen = end - s;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void regexFree(Regex *re) {
+  if (!re) return;
+  flushDfa(&re->anchored);
+  flushDfa(&re->unanchored);
+  free(re->states);
+  free(re->sets);
+  free(re->prefix);
+  free(re->stack);
+  free(re->list);
+  free(re->mark);
+  free(re);
+}
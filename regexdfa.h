@@ -0,0 +1,29 @@
+#ifndef REGEXDFA_H
+#define REGEXDFA_H
+#include <stddef.h>
+
+/*
+  Regular expressions compiled once to an NFA and run as a lazy DFA: DFA
+  states are built from sets of NFA states the first time the search
+  reaches them and cached, so a search costs one table lookup per byte
+  and does no allocation once the states it needs exist.
+
+  Supported: literals, . [] [^] \d \w \s \D \W \S, escapes, * + ? {n}
+  {n,} {n,m}, | and (), ^ and $ (start and end of the row).
+  Matches are leftmost-longest.
+ */
+typedef struct Regex Regex;
+
+/*
+  Returns NULL and sets *err to why if the pattern doesn't compile, which
+  includes patterns whose repeats expand to too many states.
+ */
+Regex* regexCompile(const char *pattern, const char **err);
+/*
+  Find the leftmost match starting at or after from in text[0, len).
+  Returns 1 and sets *mstart and *mlen if there is one.
+ */
+int regexSearch(Regex *re, const char *text, size_t len, size_t from,
+                size_t *mstart, size_t *mlen);
+void regexFree(Regex *re);
+#endif
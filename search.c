@@ -0,0 +1,118 @@
+#include "search.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char* searchScalar(const char *hay, size_t haylen,
+                                const char *needle, size_t needlelen) {
+  const char *p = hay;
+  const char *end = hay + haylen - needlelen + 1;
+  while (p < end) {
+    // memchr is vectorized by libc, use it to find the first byte
+    p = memchr(p, needle[0], end - p);
+    if (!p)
+      return NULL;
+    if (memcmp(p + 1, needle + 1, needlelen - 1) == 0)
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+const char* searchMem(const char *hay, size_t haylen, const char *needle, size_t needlelen) {
+  if (needlelen == 0)
+    return hay;
+  if (needlelen > haylen)
+    return NULL;
+  if (needlelen == 1)
+    return memchr(hay, needle[0], haylen);
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needlelen - 1]);
+  size_t i = 0;
+  // both loads must stay inside hay
+  for (; i + needlelen - 1 + 16 <= haylen; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(hay + i + needlelen - 1));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, needlelen - 2) == 0)
+        return hay + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return searchScalar(hay + i, haylen - i, needle, needlelen);
+#else
+  return searchScalar(hay, haylen, needle, needlelen);
+#endif
+}
+
+const char* searchMemLast(const char *hay, size_t limit, size_t haylen,
+                          const char *needle, size_t needlelen) {
+  const char *found = NULL;
+  const char *p = hay;
+  size_t left = haylen;
+  while ((p = searchMem(p, left, needle, needlelen)) && (size_t)(p - hay) < limit) {
+    found = p;
+    p++;
+    left = haylen - (p - hay);
+  }
+  return found;
+}
+
+size_t searchCount(const char *s, size_t len, char c) {
+  size_t count = 0;
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i needle = _mm_set1_epi8(c);
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 16 <= len) {
+    /*
+      cmpeq gives -1 per matching byte, subtracting it counts matches in
+      16 byte lanes, which are summed into count before any can overflow.
+     */
+    __m128i lanes = zero;
+    size_t stop = i + 255 * 16 < len ? i + 255 * 16 : len;
+    for (; i + 16 <= stop; i += 16) {
+      __m128i b = _mm_loadu_si128((const __m128i *)(s + i));
+      lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(b, needle));
+    }
+    __m128i sums = _mm_sad_epu8(lanes, zero);
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+  }
+#endif
+  for (; i < len; i++)
+    count += s[i] == c;
+  return count;
+}
+
+const char* searchNth(const char *s, size_t len, char c, size_t n) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i needle = _mm_set1_epi8(c);
+  // 64 bytes per step, skipped whole while they hold n or fewer matches
+  for (; i + 64 <= len; i += 64) {
+    unsigned long long mask = 0;
+    for (int k = 0; k < 4; k++) {
+      __m128i b = _mm_loadu_si128((const __m128i *)(s + i + k * 16));
+      mask |= (unsigned long long)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, needle)) << (k * 16);
+    }
+    size_t found = __builtin_popcountll(mask);
+    if (n >= found) {
+      n -= found;
+      continue;
+    }
+    while (n--)
+      mask &= mask - 1;
+    return s + i + __builtin_ctzll(mask);
+  }
+#endif
+  for (; i < len; i++) {
+    if (s[i] == c && n-- == 0)
+      return s + i;
+  }
+  return NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+#include <stddef.h>
+
+/*
+  Find the first occurrence of needle in hay, like memmem. Candidates are
+  filtered 16 bytes at a time by comparing the first and last byte of the
+  needle with SSE2 where it is available; only positions where both match
+  are compared in full.
+ */
+const char* searchMem(const char *hay, size_t haylen, const char *needle, size_t needlelen);
+
+/* last occurrence of needle that starts before limit, or NULL */
+const char* searchMemLast(const char *hay, size_t limit, size_t haylen,
+                          const char *needle, size_t needlelen);
+
+/*
+  Count the bytes equal to c in s, or find the n'th of them counting from
+  0, NULL if there are fewer. Both compare 16 bytes at a time with SSE2
+  where it is available; file loading finds its lines with them.
+ */
+size_t searchCount(const char *s, size_t len, char c);
+const char* searchNth(const char *s, size_t len, char c, size_t n);
+#endif
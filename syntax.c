@@ -0,0 +1,269 @@
+#include "syntax.h"
+#include <ctype.h>
+#include <string.h>
+
+/* lexer states of C, state 0 is normal code */
+#define C_IN_COMMENT 1 // inside /* */
+
+static const char *cKeywords[] = {
+  "break", "case", "continue", "default", "do", "else", "for", "goto", "if",
+  "return", "switch", "while", "sizeof", "typedef", "struct", "union", "enum",
+  "static", "extern", "const", "volatile", "inline", "register", "restrict",
+  "class", "namespace", "template", "typename", "public", "private",
+  "protected", "virtual", "override", "new", "delete", "this", "try",
+  "catch", "throw", "using", "operator", "friend", "constexpr", "nullptr",
+  "true", "false", "NULL", "auto", NULL
+};
+
+static const char *cTypes[] = {
+  "void", "char", "short", "int", "long", "float", "double", "signed",
+  "unsigned", "bool", "size_t", "ssize_t", "int8_t", "int16_t", "int32_t",
+  "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t", "wchar_t", NULL
+};
+
+static int isSeparator(int c) {
+  return c == '\0' || isspace(c) || strchr(",.()+-/*=~%<>[];{}:!&|^?\"'", c);
+}
+
+static int isWordChar(int c) {
+  return isalnum(c) || c == '_';
+}
+
+/* length of the word at text if it is one of words, else 0 */
+static size_t matchWord(const char *text, size_t len, const char **words) {
+  size_t n = 0;
+  while (n < len && isWordChar((unsigned char)text[n]))
+    n++;
+  for (int i = 0; words[i]; i++) {
+    if (strlen(words[i]) == n && memcmp(text, words[i], n) == 0)
+      return n;
+  }
+  return 0;
+}
+
+/* a quoted string or char starting at text[i], returns the index after it */
+static size_t lexString(const char *text, size_t len, size_t i, unsigned char *hl) {
+  char quote = text[i];
+  hl[i++] = HL_STRING;
+  while (i < len) {
+    hl[i] = HL_STRING;
+    if (text[i] == '\\' && i + 1 < len) {
+      hl[i + 1] = HL_STRING;
+      i += 2;
+      continue;
+    }
+    if (text[i++] == quote)
+      break;
+  }
+  return i;
+}
+
+/* a number starting at text[i]: decimal, hex, float and suffixes */
+static size_t lexNumber(const char *text, size_t len, size_t i, unsigned char *hl) {
+  hl[i++] = HL_NUMBER;
+  while (i < len && (isalnum((unsigned char)text[i]) || text[i] == '.' ||
+                     ((text[i] == '-' || text[i] == '+') &&
+                      (text[i - 1] == 'e' || text[i - 1] == 'E'))))
+    hl[i++] = HL_NUMBER;
+  return i;
+}
+
+static int highlightC(const char *text, size_t len, int state, unsigned char *hl) {
+  memset(hl, HL_NORMAL, len);
+  size_t i = 0;
+  // a directive runs to the end of the line, comments inside it still show
+  size_t j = 0;
+  while (j < len && isspace((unsigned char)text[j]))
+    j++;
+  int preproc = state == 0 && j < len && text[j] == '#';
+  int prevsep = 1;
+  while (i < len) {
+    if (state == C_IN_COMMENT) {
+      hl[i] = HL_COMMENT;
+      if (text[i] == '*' && i + 1 < len && text[i + 1] == '/') {
+        hl[i + 1] = HL_COMMENT;
+        i += 2;
+        state = 0;
+        prevsep = 1;
+      } else {
+        i++;
+      }
+      continue;
+    }
+    char c = text[i];
+    if (c == '/' && i + 1 < len && text[i + 1] == '/') {
+      memset(&hl[i], HL_COMMENT, len - i);
+      break;
+    }
+    if (c == '/' && i + 1 < len && text[i + 1] == '*') {
+      hl[i] = hl[i + 1] = HL_COMMENT;
+      i += 2;
+      state = C_IN_COMMENT;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      i = lexString(text, len, i, hl);
+      prevsep = 1;
+      continue;
+    }
+    if (preproc) {
+      hl[i++] = HL_PREPROC;
+      continue;
+    }
+    if (prevsep && (isdigit((unsigned char)c) ||
+                    (c == '.' && i + 1 < len && isdigit((unsigned char)text[i + 1])))) {
+      i = lexNumber(text, len, i, hl);
+      prevsep = 0;
+      continue;
+    }
+    if (prevsep && isWordChar((unsigned char)c)) {
+      size_t n;
+      if ((n = matchWord(&text[i], len - i, cKeywords))) {
+        memset(&hl[i], HL_KEYWORD, n);
+      } else if ((n = matchWord(&text[i], len - i, cTypes))) {
+        memset(&hl[i], HL_TYPE, n);
+      } else {
+        n = 1;
+        while (i + n < len && isWordChar((unsigned char)text[i + n]))
+          n++;
+      }
+      i += n;
+      prevsep = 0;
+      continue;
+    }
+    prevsep = isSeparator((unsigned char)c);
+    i++;
+  }
+  return state;
+}
+
+static int highlightJSON(const char *text, size_t len, int state, unsigned char *hl) {
+  memset(hl, HL_NORMAL, len);
+  size_t i = 0;
+  while (i < len) {
+    char c = text[i];
+    if (c == '"') {
+      size_t start = i;
+      i = lexString(text, len, i, hl);
+      // a string followed by a colon is a key
+      size_t j = i;
+      while (j < len && isspace((unsigned char)text[j]))
+        j++;
+      if (j < len && text[j] == ':')
+        memset(&hl[start], HL_KEY, i - start);
+    } else if (isdigit((unsigned char)c) || c == '-') {
+      i = lexNumber(text, len, i, hl);
+    } else if (isalpha((unsigned char)c)) {
+      // true, false and null
+      size_t n = 0;
+      while (i + n < len && isalpha((unsigned char)text[i + n]))
+        n++;
+      memset(&hl[i], HL_KEYWORD, n);
+      i += n;
+    } else {
+      i++;
+    }
+  }
+  return state;
+}
+
+/*
+  Log lines: a leading timestamp, the level word and quoted strings and
+  numbers in the message. Lines don't carry state into the next one.
+ */
+static int highlightLog(const char *text, size_t len, int state, unsigned char *hl) {
+  static const char *errors[] = {"ERROR", "FATAL", "CRITICAL", "PANIC", "error", "fatal", NULL};
+  static const char *warnings[] = {"WARN", "WARNING", "warn", "warning", NULL};
+  static const char *levels[] = {"INFO", "DEBUG", "TRACE", "NOTICE", "info", "debug", "trace", NULL};
+  memset(hl, HL_NORMAL, len);
+  size_t i = 0;
+  // timestamp: digits and the punctuation of dates and times, up front
+  size_t j = 0;
+  if (j < len && text[j] == '[')
+    j++;
+  int digits = 0;
+  while (j < len && (isdigit((unsigned char)text[j]) || strchr("-:.,/TZ+ ", text[j]))) {
+    if (isdigit((unsigned char)text[j]))
+      digits++;
+    j++;
+  }
+  if (j < len && text[j] == ']')
+    j++;
+  if (digits >= 4) {
+    memset(hl, HL_TIME, j);
+    i = j;
+  }
+  int prevsep = 1;
+  while (i < len) {
+    unsigned char c = text[i];
+    if (c == '"') {
+      i = lexString(text, len, i, hl);
+      prevsep = 1;
+      continue;
+    }
+    if (prevsep && isdigit(c)) {
+      i = lexNumber(text, len, i, hl);
+      prevsep = 0;
+      continue;
+    }
+    if (prevsep && isalpha(c)) {
+      size_t n;
+      if ((n = matchWord(&text[i], len - i, errors))) {
+        memset(&hl[i], HL_ERROR, n);
+      } else if ((n = matchWord(&text[i], len - i, warnings))) {
+        memset(&hl[i], HL_WARNING, n);
+      } else if ((n = matchWord(&text[i], len - i, levels))) {
+        memset(&hl[i], HL_KEYWORD, n);
+      } else {
+        n = 1;
+        while (i + n < len && isWordChar((unsigned char)text[i + n]))
+          n++;
+      }
+      i += n;
+      prevsep = 0;
+      continue;
+    }
+    prevsep = isSeparator(c);
+    i++;
+  }
+  return state;
+}
+
+static const char *cExtensions[] = {".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL};
+static const char *jsonExtensions[] = {".json", NULL};
+static const char *logExtensions[] = {".log", NULL};
+
+static const Syntax syntaxes[] = {
+  {"c", cExtensions, highlightC},
+  {"json", jsonExtensions, highlightJSON},
+  {"log", logExtensions, highlightLog},
+};
+
+const Syntax* syntaxForFile(const char *filename) {
+  const char *ext = filename ? strrchr(filename, '.') : NULL;
+  if (!ext)
+    return NULL;
+  for (size_t i = 0; i < sizeof(syntaxes) / sizeof(syntaxes[0]); i++) {
+    for (int j = 0; syntaxes[i].extensions[j]; j++) {
+      if (strcmp(ext, syntaxes[i].extensions[j]) == 0)
+        return &syntaxes[i];
+    }
+  }
+  return NULL;
+}
+
+int syntaxColor(int hl) {
+  switch (hl) {
+  case HL_COMMENT: return 36;
+  case HL_KEYWORD: return 33;
+  case HL_TYPE: return 32;
+  case HL_STRING: return 35;
+  case HL_NUMBER: return 31;
+  case HL_PREPROC: return 34;
+  case HL_KEY: return 36;
+  case HL_TIME: return 34;
+  case HL_ERROR: return 91;
+  case HL_WARNING: return 93;
+  default: return 39;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+#include <stddef.h>
+
+/* highlight class of each rendered char */
+enum highlight {
+  HL_NORMAL = 0,
+  HL_COMMENT,
+  HL_KEYWORD, // statements, or the level of a log line
+  HL_TYPE,
+  HL_STRING,
+  HL_NUMBER,
+  HL_PREPROC,
+  HL_KEY, // object keys in JSON
+  HL_TIME, // timestamps in logs
+  HL_ERROR, // error levels in logs
+  HL_WARNING,
+  HL_MATCH // a match of the running search, drawn in inverse video
+};
+
+/*
+  A language is a line lexer: it highlights len chars of text into hl,
+  starting in the lexer state left by the line before, and returns the
+  state at the end of the line. State 0 is the start of a file.
+ */
+typedef struct Syntax {
+  const char *name;
+  const char **extensions; // NULL terminated, matched against the file name
+  int (*highlight)(const char *text, size_t len, int state, unsigned char *hl);
+} Syntax;
+
+/* language for filename, NULL if none */
+const Syntax* syntaxForFile(const char *filename);
+/* SGR color code to draw hl with */
+int syntaxColor(int hl);
+#endif
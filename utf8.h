@@ -0,0 +1,15 @@
+#ifndef UTF8_H
+#define UTF8_H
+#include <stddef.h>
+
+/*
+  Decode the UTF-8 char at s, which has len bytes left. Returns its length
+  in bytes and sets *cp to the code point, or to -1 for an invalid or cut
+  off sequence, which then counts as a single byte.
+ */
+int utf8Decode(const char *s, size_t len, int *cp);
+/* columns cp takes on a terminal: 0 for combining marks, 2 for East Asian wide */
+int utf8Width(int cp);
+/* 1 if s has no bytes >= 0x80, checked 16 bytes at a time with SSE2 */
+int utf8IsAscii(const char *s, size_t len);
+#endif
@@ -0,0 +1,191 @@
+#include "vterm.h"
+#include "utf8.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { VT_TEXT, VT_ESC, VT_CSI };
+
+VTerm* createVTerm(int rows, int cols) {
+  VTerm *term = (VTerm*)calloc(1, sizeof(VTerm));
+  if (!term) return NULL;
+  term->cells = (int*)malloc(sizeof(int) * rows * cols);
+  if (!term->cells) {
+    free(term);
+    return NULL;
+  }
+  term->rows = rows;
+  term->cols = cols;
+  term->cursorvisible = 1;
+  for (int i = 0; i < rows * cols; i++)
+    term->cells[i] = ' ';
+  return term;
+}
+
+static void vtermClear(VTerm *term, int from, int to) {
+  for (int i = from; i < to; i++)
+    term->cells[i] = ' ';
+}
+
+static void vtermPut(VTerm *term, int cp) {
+  int width = cp < 0 ? 1 : utf8Width(cp);
+  if (cp < 0) cp = 0xfffd;
+  // combining marks are dropped, each cell keeps one code point
+  if (width == 0 || term->cx + width > term->cols)
+    return;
+  int *line = &term->cells[term->cy * term->cols];
+  line[term->cx] = cp;
+  if (width == 2)
+    line[term->cx + 1] = 0;
+  term->cx += width;
+}
+
+/* parameter i of the CSI sequence, def if it is missing */
+static int vtermParam(VTerm *term, int i, int def) {
+  const char *p = term->seq;
+  if (*p == '?') p++;
+  while (i-- > 0) {
+    p = strchr(p, ';');
+    if (!p) return def;
+    p++;
+  }
+  if (*p < '0' || *p > '9') return def;
+  return atoi(p);
+}
+
+static void vtermCsi(VTerm *term, char final) {
+  int n;
+  switch (final) {
+  case 'H':
+    term->cy = vtermParam(term, 0, 1) - 1;
+    term->cx = vtermParam(term, 1, 1) - 1;
+    break;
+  case 'A':
+    term->cy -= vtermParam(term, 0, 1);
+    break;
+  case 'B':
+    term->cy += vtermParam(term, 0, 1);
+    break;
+  case 'C':
+    term->cx += vtermParam(term, 0, 1);
+    break;
+  case 'D':
+    term->cx -= vtermParam(term, 0, 1);
+    break;
+  case 'K':
+    n = vtermParam(term, 0, 0);
+    vtermClear(term, term->cy * term->cols + (n == 0 ? term->cx : 0),
+               term->cy * term->cols + (n == 1 ? term->cx : term->cols));
+    break;
+  case 'J':
+    n = vtermParam(term, 0, 0);
+    if (n == 2)
+      vtermClear(term, 0, term->rows * term->cols);
+    else if (n == 0)
+      vtermClear(term, term->cy * term->cols + term->cx, term->rows * term->cols);
+    break;
+  case 'h':
+  case 'l':
+    if (strcmp(term->seq, "?25") == 0)
+      term->cursorvisible = final == 'h';
+    break;
+  }
+  // the cursor never leaves the screen
+  if (term->cy < 0) term->cy = 0;
+  if (term->cy >= term->rows) term->cy = term->rows - 1;
+  if (term->cx < 0) term->cx = 0;
+  if (term->cx > term->cols) term->cx = term->cols;
+}
+
+void vtermWrite(VTerm *term, const char *s, size_t len) {
+  term->bytes += len;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (term->state == VT_ESC) {
+      term->state = c == '[' ? VT_CSI : VT_TEXT;
+      term->seqlen = 0;
+      term->seq[0] = '\0';
+      continue;
+    }
+    if (term->state == VT_CSI) {
+      if (c >= 0x40 && c <= 0x7e) {
+        vtermCsi(term, c);
+        term->state = VT_TEXT;
+      } else if (term->seqlen < (int)sizeof(term->seq) - 1) {
+        term->seq[term->seqlen++] = c;
+        term->seq[term->seqlen] = '\0';
+      }
+      continue;
+    }
+    if (term->utflen > 0) {
+      if ((c & 0xc0) == 0x80) {
+        term->utf[term->utflen++] = c;
+        int cp;
+        if (utf8Decode(term->utf, term->utflen, &cp) == term->utflen && cp >= 0) {
+          vtermPut(term, cp);
+          term->utflen = 0;
+        } else if (term->utflen == 4) {
+          vtermPut(term, -1);
+          term->utflen = 0;
+        }
+        continue;
+      }
+      vtermPut(term, -1);
+      term->utflen = 0;
+    }
+    if (c == '\x1b') {
+      term->state = VT_ESC;
+    } else if (c == '\r') {
+      term->cx = 0;
+    } else if (c == '\n') {
+      if (term->cy < term->rows - 1)
+        term->cy++;
+    } else if (c >= 0x80) {
+      term->utf[0] = c;
+      term->utflen = 1;
+    } else if (c >= ' ' && c != 0x7f) {
+      vtermPut(term, c);
+    }
+  }
+}
+
+static int encodeUtf8(int cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  } else if (cp < 0x10000) {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  out[0] = 0xf0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3f);
+  out[2] = 0x80 | ((cp >> 6) & 0x3f);
+  out[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+int vtermLine(VTerm *term, int y, char *buf, int size) {
+  int *line = &term->cells[y * term->cols];
+  int end = term->cols;
+  while (end > 0 && line[end - 1] == ' ')
+    end--;
+  int len = 0;
+  for (int x = 0; x < end && len + 4 < size; x++) {
+    if (line[x] != 0)
+      len += encodeUtf8(line[x], &buf[len]);
+  }
+  if (size > 0)
+    buf[len] = '\0';
+  return len;
+}
+
+void destroyVTerm(VTerm *term) {
+  if (!term) return;
+  free(term->cells);
+  free(term);
+}
@@ -0,0 +1,30 @@
+#ifndef VTERM_H
+#define VTERM_H
+#include <stddef.h>
+
+/*
+  In-memory terminal for running the editor without a tty. It understands
+  the subset of VT100 the editor writes: cursor positioning, erase in line
+  and display, and UTF-8 text. Colors and modes are accepted and ignored.
+  Writes past the last column are dropped instead of wrapping.
+ */
+typedef struct {
+  int rows;
+  int cols;
+  int *cells; // code point of each cell, 0 for the right half of a wide char
+  int cy, cx; // cursor
+  int cursorvisible;
+  size_t bytes; // everything written so far
+  int state; // escape sequence parser state
+  char seq[32]; // parameters of the CSI sequence being parsed
+  int seqlen;
+  char utf[4]; // UTF-8 char being assembled
+  int utflen;
+} VTerm;
+
+VTerm* createVTerm(int rows, int cols);
+void vtermWrite(VTerm *term, const char *s, size_t len);
+/* UTF-8 text of screen row y without trailing blanks into buf, returns its length */
+int vtermLine(VTerm *term, int y, char *buf, int size);
+void destroyVTerm(VTerm *term);
+#endif